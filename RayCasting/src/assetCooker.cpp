@@ -0,0 +1,137 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <filesystem>
+#include <optional>
+
+#include "media.hpp"
+#include "texture.hpp"
+#include "level.hpp"
+
+
+// Offline cook step: decodes each BMP given on the command line, builds its mip chain and
+// writes it next to the source as a .rctex file that the game maps without conversion.
+// JSON levels are cut in chunks and written next to the source as a .rclevel file.
+//
+//     AssetCooker [--layout argb] assets/textures/brick.bmp ... assets/levels/demo.json
+//
+// Textures are written in the pixel layout of the window, ARGB8888 on most platforms.
+// A game whose window has another layout still loads them, but converts them on load.
+
+auto parseLayout(const std::string& name) -> std::optional<ds::PixelLayout>
+{
+	if (name == "rgba")
+	{
+		return ds::rgbaLayout;
+	}
+
+	if (name == "argb")
+	{
+		return ds::argbLayout;
+	}
+
+	if (name == "abgr")
+	{
+		return ds::abgrLayout;
+	}
+
+	if (name == "bgra")
+	{
+		return ds::bgraLayout;
+	}
+
+	return std::nullopt;
+}
+
+
+auto cookTexture(const std::string& filename, const ds::PixelLayout& layout) -> std::expected<std::string, std::string>
+{
+	auto image = media::imageFromBitMapFile(filename);
+
+	if (!image.has_value())
+	{
+		return std::unexpected(image.error());
+	}
+
+	texture::Texture texture = texture::createTexture(std::move(image.value()));
+	texture::convertTexture(texture, layout);
+
+	const std::string cookedFilename = std::filesystem::path(filename).replace_extension(".rctex").string();
+
+	auto result = texture::writeCookedTexture(texture, cookedFilename);
+
+	if (!result.has_value())
+	{
+		return std::unexpected(result.error());
+	}
+
+	return cookedFilename;
+}
+
+
+auto cookLevel(const std::string& filename) -> std::expected<std::string, std::string>
+{
+	auto description = level::loadLevelDescription(filename);
+
+	if (!description.has_value())
+	{
+		return std::unexpected(description.error());
+	}
+
+	const std::string cookedFilename = std::filesystem::path(filename).replace_extension(".rclevel").string();
+
+	auto result = level::writeCookedLevel(description.value(), cookedFilename);
+
+	if (!result.has_value())
+	{
+		return std::unexpected(result.error());
+	}
+
+	return cookedFilename;
+}
+
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cout << "Usage: AssetCooker [--layout <rgba | argb | abgr | bgra>] <image.bmp | level.json>...\n";
+		return 1;
+	}
+
+	ds::PixelLayout layout = ds::argbLayout;
+	int failures = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) == "--layout")
+		{
+			const std::optional<ds::PixelLayout> parsed = i + 1 < argc ? parseLayout(argv[i + 1]) : std::nullopt;
+
+			if (!parsed.has_value())
+			{
+				std::cout << "Option '--layout' needs one of rgba, argb, abgr or bgra\n";
+				return 1;
+			}
+
+			layout = parsed.value();
+			i++;
+			continue;
+		}
+
+		const bool isLevel = std::filesystem::path(argv[i]).extension() == ".json";
+		auto result = isLevel ? cookLevel(argv[i]) : cookTexture(argv[i], layout);
+
+		if (result.has_value())
+		{
+			std::cout << argv[i] << " -> " << result.value() << "\n";
+		}
+		else
+		{
+			std::cout << result.error() << "\n";
+			failures += 1;
+		}
+	}
+
+	return failures == 0 ? 0 : 1;
+}
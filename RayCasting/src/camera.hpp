@@ -7,6 +7,8 @@
 #include <glm/gtx/matrix_transform_2d.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 
+#include "ds.hpp"
+
 namespace camera
 {
 	struct Camera
@@ -61,6 +63,25 @@ namespace camera
 		friction(camera);
 	}
 
+	// Camera drawn between two simulation steps, alpha is how far from previous to current
+	auto interpolateCamera(const Camera& previous, const Camera& current, const float alpha) -> Camera
+	{
+		Camera result = current;
+
+		result.position = glm::mix(previous.position, current.position, alpha);
+		result.height = glm::mix(previous.height, current.height, alpha);
+		result.fov = glm::mix(previous.fov, current.fov, alpha);
+
+		const glm::vec2 front = glm::mix(previous.front, current.front, alpha);
+
+		if (glm::length(front) > 0.0001f)
+		{
+			result.front = glm::normalize(front);
+		}
+
+		return result;
+	}
+
 	auto getTransform(const Camera& camera) -> glm::mat3
 	{
 		auto id = glm::mat3(1.0f);
@@ -4,6 +4,8 @@
 #include <glm/vec3.hpp>
 #include <glm/vec2.hpp>
 
+#include <cstdint>
+
 namespace ds
 {
 	using ColorRGBA = glm::ivec4;
@@ -11,4 +13,79 @@ namespace ds
 	using Vec4 = glm::vec4;
 	using Vec3 = glm::vec3;
 	using Vec2 = glm::vec2;
-}
\ No newline at end of file
+
+	// 8 bit per channel color packed as RGBA8888, red in the high byte. Textures are
+	// converted once to the layout of the screen, so texels are copied without conversion.
+	using PackedColor = uint32_t;
+
+	// Bit offset of each channel in a packed 32 bit pixel
+	struct PixelLayout
+	{
+		uint32_t r;
+		uint32_t g;
+		uint32_t b;
+		uint32_t a;
+
+		constexpr auto operator==(const PixelLayout&) const -> bool = default;
+	};
+
+	constexpr PixelLayout rgbaLayout = { 24, 16, 8, 0 };
+	constexpr PixelLayout argbLayout = { 16, 8, 0, 24 };
+	constexpr PixelLayout abgrLayout = { 0, 8, 16, 24 };
+	constexpr PixelLayout bgraLayout = { 8, 16, 24, 0 };
+
+	// True when every channel is a distinct whole byte of the pixel
+	constexpr auto isByteLayout(const PixelLayout& layout) -> bool
+	{
+		const uint32_t offsets[4] = { layout.r, layout.g, layout.b, layout.a };
+		uint32_t usedBytes = 0;
+
+		for (const uint32_t offset : offsets)
+		{
+			if (offset > 24 || offset % 8 != 0)
+			{
+				return false;
+			}
+
+			usedBytes |= 1u << (offset / 8);
+		}
+
+		return usedBytes == 0xF;
+	}
+
+	constexpr auto packColor(const int r, const int g, const int b, const int a) -> PackedColor
+	{
+		return ((PackedColor)r << 24) | ((PackedColor)g << 16) | ((PackedColor)b << 8) | (PackedColor)a;
+	}
+
+	constexpr auto packColor(const ColorRGBA& color) -> PackedColor
+	{
+		return packColor(color.r, color.g, color.b, color.a);
+	}
+
+	constexpr auto unpackColor(const PackedColor color) -> ColorRGBA
+	{
+		return ColorRGBA((color >> 24) & 0xFF, (color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF);
+	}
+
+	constexpr auto packColor(const ColorRGBA& color, const PixelLayout& layout) -> PackedColor
+	{
+		return ((PackedColor)color.r << layout.r) | ((PackedColor)color.g << layout.g) | ((PackedColor)color.b << layout.b) | ((PackedColor)color.a << layout.a);
+	}
+
+	constexpr auto unpackColor(const PackedColor color, const PixelLayout& layout) -> ColorRGBA
+	{
+		return ColorRGBA((color >> layout.r) & 0xFF, (color >> layout.g) & 0xFF, (color >> layout.b) & 0xFF, (color >> layout.a) & 0xFF);
+	}
+
+	// Moves the channels of an RGBA8888 color to their place in layout
+	constexpr auto convertColor(const PackedColor color, const PixelLayout& layout) -> PackedColor
+	{
+		return packColor(unpackColor(color), layout);
+	}
+
+	constexpr auto convertColor(const PackedColor color, const PixelLayout& from, const PixelLayout& to) -> PackedColor
+	{
+		return packColor(unpackColor(color, from), to);
+	}
+}
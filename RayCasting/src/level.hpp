@@ -0,0 +1,1301 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <string>
+#include <map>
+#include <memory>
+#include <optional>
+#include <limits>
+#include <tuple>
+#include <expected>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#include <glm/gtc/constants.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include "ds.hpp"
+#include "wall.hpp"
+#include "spatial.hpp"
+#include "rendering.hpp"
+#include "media.hpp"
+#include "threading.hpp"
+#include "scene.hpp"
+
+
+// Levels are authored as JSON and cooked by AssetCooker into a binary file cut in square
+// chunks, each with its walls, sprites and wall grid. The game only decodes the chunks
+// around the camera, see ChunkStreamer.
+namespace level
+{
+	// Level as authored. Walls and sprites are in world units, sprites refer to textures
+	// by their position in the texture manifest.
+	//
+	//     {
+	//         "textures": "../textures.json",
+	//         "chunkSize": 8,
+	//         "cellsPerChunk": 4,
+	//         "pvs": { "samples": 4, "rays": 2048, "distance": 100 },
+	//         "walls": [ { "start": [4, 1], "end": [2, 1], "height": 1 }, ... ],
+	//         "sprites": [ { "texture": 2, "position": [2.4, 1.9], "size": 0.3, "height": -0.2 }, ... ]
+	//     }
+	//
+	// "pvs": false cooks the level without potentially visible sets.
+	struct LevelDescription
+	{
+		// Texture manifest, relative to the level file
+		std::string texturesFilename;
+
+		float chunkSize = 8.0f;
+		uint32_t cellsPerChunk = 4;
+
+		// Sample points per chunk side, rays per sample point and how far they reach, see
+		// buildVisibility
+		bool buildPvs = true;
+		uint32_t pvsSamples = 8;
+		uint32_t pvsRays = 1024;
+		float pvsDistance = 100.0f;
+
+		std::vector<wall::Wall> walls;
+		std::vector<rendering::Sprite> sprites;
+	};
+
+
+	auto loadLevelDescription(const std::string& filename) -> std::expected<LevelDescription, std::string>
+	{
+		std::ifstream fileStream(filename);
+
+		if (!fileStream.is_open())
+		{
+			return std::unexpected(std::format("Failed to open level '{}'", filename));
+		}
+
+		const nlohmann::json file = nlohmann::json::parse(fileStream, nullptr, false);
+
+		if (file.is_discarded() || !file.is_object())
+		{
+			return std::unexpected(std::format("Level '{}' is not a JSON object", filename));
+		}
+
+		const auto isNumber = [](const nlohmann::json& value) { return value.is_number(); };
+
+		const auto isVec2 = [&](const nlohmann::json& value)
+			{
+				return value.is_array() && value.size() == 2 && std::all_of(value.begin(), value.end(), isNumber);
+			};
+
+		const auto toVec2 = [](const nlohmann::json& value)
+			{
+				return ds::Vec2(value[0].get<float>(), value[1].get<float>());
+			};
+
+		LevelDescription description;
+
+		if (!file.contains("textures") || !file["textures"].is_string())
+		{
+			return std::unexpected(std::format("Level '{}' does not name its texture manifest", filename));
+		}
+
+		description.texturesFilename = file["textures"].get<std::string>();
+
+		if (file.contains("chunkSize"))
+		{
+			description.chunkSize = file["chunkSize"].is_number() ? file["chunkSize"].get<float>() : 0.0f;
+		}
+
+		if (file.contains("cellsPerChunk"))
+		{
+			description.cellsPerChunk = file["cellsPerChunk"].is_number_unsigned() ? (uint32_t)std::min<uint64_t>(file["cellsPerChunk"].get<uint64_t>(), 1024) : 0;
+		}
+
+		if (!(description.chunkSize > 0.0f) || description.cellsPerChunk == 0 || description.cellsPerChunk > 256)
+		{
+			return std::unexpected(std::format("Level '{}' needs a positive chunk size and 1 to 256 cells per chunk", filename));
+		}
+
+		const nlohmann::json pvs = file.value("pvs", nlohmann::json::object());
+
+		if (pvs.is_boolean())
+		{
+			description.buildPvs = pvs.get<bool>();
+		}
+		else if (pvs.is_object())
+		{
+			const nlohmann::json samples = pvs.value("samples", nlohmann::json(description.pvsSamples));
+			const nlohmann::json rays = pvs.value("rays", nlohmann::json(description.pvsRays));
+			const nlohmann::json distance = pvs.value("distance", nlohmann::json(description.pvsDistance));
+
+			if (!samples.is_number_unsigned() || !rays.is_number_unsigned() || !distance.is_number())
+			{
+				return std::unexpected(std::format("Level '{}' has invalid PVS settings", filename));
+			}
+
+			description.pvsSamples = (uint32_t)std::clamp<uint64_t>(samples.get<uint64_t>(), 2, 64);
+			description.pvsRays = (uint32_t)std::clamp<uint64_t>(rays.get<uint64_t>(), 16, 65536);
+			description.pvsDistance = distance.get<float>();
+		}
+		else
+		{
+			return std::unexpected(std::format("PVS settings of level '{}' have to be an object or a boolean", filename));
+		}
+
+		const nlohmann::json walls = file.value("walls", nlohmann::json::array());
+		const nlohmann::json sprites = file.value("sprites", nlohmann::json::array());
+
+		if (!walls.is_array() || !sprites.is_array())
+		{
+			return std::unexpected(std::format("Walls and sprites of level '{}' have to be lists", filename));
+		}
+
+		for (const auto& entry : walls)
+		{
+			if (!entry.is_object() || !isVec2(entry.value("start", nlohmann::json())) || !isVec2(entry.value("end", nlohmann::json())))
+			{
+				return std::unexpected(std::format("Level '{}' has a wall without start and end points", filename));
+			}
+
+			const nlohmann::json color = entry.value("color", nlohmann::json::array({ 0, 0, 0 }));
+
+			if (!color.is_array() || color.size() != 3 || !std::all_of(color.begin(), color.end(), isNumber) || !entry.value("height", nlohmann::json(1.0f)).is_number())
+			{
+				return std::unexpected(std::format("Level '{}' has a wall with an invalid height or color", filename));
+			}
+
+			if (!entry.value("material", nlohmann::json(0u)).is_number_unsigned())
+			{
+				return std::unexpected(std::format("Level '{}' has a wall with an invalid material", filename));
+			}
+
+			description.walls.emplace_back(toVec2(entry["start"]), toVec2(entry["end"]), entry.value("height", 1.0f),
+				ds::ColorRGB(color[0].get<int>(), color[1].get<int>(), color[2].get<int>()), entry.value("material", 0u));
+		}
+
+		for (const auto& entry : sprites)
+		{
+			if (!entry.is_object() || !entry.value("texture", nlohmann::json()).is_number_unsigned() || !isVec2(entry.value("position", nlohmann::json())))
+			{
+				return std::unexpected(std::format("Level '{}' has a sprite without texture and position", filename));
+			}
+
+			if (!entry.value("size", nlohmann::json(1.0f)).is_number() || !entry.value("height", nlohmann::json(0.0f)).is_number())
+			{
+				return std::unexpected(std::format("Level '{}' has a sprite with an invalid size or height", filename));
+			}
+
+			rendering::Sprite sprite = rendering::spriteFromTexture(entry["texture"].get<rendering::TextureId>());
+			sprite.position = toVec2(entry["position"]);
+			sprite.size = entry.value("size", 1.0f);
+			sprite.height = entry.value("height", 0.0f);
+
+			description.sprites.push_back(sprite);
+		}
+
+		return description;
+	}
+
+
+	// Cooked level. A header, the texture manifest name, the textures used by sprites and a
+	// table with one entry per non empty chunk, sorted by row then column, are followed by
+	// the chunks. A chunk holds its walls, its sprites and a grid of cellsPerChunk squared
+	// cells over it in the layout of spatial::WallGrid, with indices into its own walls.
+	// Walls crossing chunk borders are stored in every chunk they overlap. With hasPvsFlag
+	// every chunk over the bounds of the level is stored, empty or not, and ends with its
+	// potentially visible set: one CookedVisibleSet per chunk it sees, sorted like the
+	// table, each followed by the indices of the walls and then of the sprites seen.
+	constexpr char cookedMagic[4] = { 'R', 'C', 'L', 'V' };
+	constexpr uint32_t cookedVersion = 3;
+
+	constexpr uint32_t hasPvsFlag = 1;
+
+	struct CookedHeader
+	{
+		char magic[4];
+		uint32_t version;
+		float chunkSize;
+		uint32_t cellsPerChunk;
+		uint32_t chunkCount;
+		uint32_t texturesLength;
+		uint32_t spriteTextureCount;
+		uint32_t flags;
+	};
+
+	struct CookedChunk
+	{
+		int32_t x;
+		int32_t y;
+		uint64_t offset;
+		uint32_t wallCount;
+		uint32_t spriteCount;
+		uint32_t entryCount;
+		uint32_t pvsSize;
+	};
+
+	struct CookedWall
+	{
+		float startX;
+		float startY;
+		float endX;
+		float endY;
+		float height;
+		int32_t color[3];
+		uint32_t material;
+	};
+
+	struct CookedSprite
+	{
+		uint32_t texture;
+		float x;
+		float y;
+		float size;
+		float height;
+	};
+
+	struct CookedVisibleSet
+	{
+		int32_t x;
+		int32_t y;
+		uint32_t wallCount;
+		uint32_t spriteCount;
+	};
+
+	static_assert(sizeof(CookedHeader) == 32 && sizeof(CookedChunk) == 32 && sizeof(CookedWall) == 36 && sizeof(CookedSprite) == 20 && sizeof(CookedVisibleSet) == 16,
+		"Cooked layout must not depend on the compiler");
+
+
+	// Bytes of a chunk after its offset
+	auto cookedChunkSize(const CookedChunk& chunk, const uint32_t cellsPerChunk) -> uint64_t
+	{
+		const uint64_t numCells = (uint64_t)cellsPerChunk * cellsPerChunk;
+
+		return (uint64_t)chunk.wallCount * sizeof(CookedWall)
+			+ (uint64_t)chunk.spriteCount * sizeof(CookedSprite)
+			+ (numCells + 1) * sizeof(uint32_t)
+			+ (uint64_t)chunk.entryCount * (sizeof(uint32_t) + 5 * sizeof(float))
+			+ chunk.pvsSize;
+	}
+
+
+	// Walls and sprites of chunk (x, y) that can be seen from the chunk owning the set, as
+	// indices into the walls and sprites of chunk (x, y)
+	struct VisibleSet
+	{
+		int32_t x;
+		int32_t y;
+		std::vector<uint32_t> walls;
+		std::vector<uint32_t> sprites;
+	};
+
+
+	struct Chunk
+	{
+		int32_t x = 0;
+		int32_t y = 0;
+
+		std::vector<wall::Wall> walls;
+		std::vector<rendering::Sprite> sprites;
+
+		// Cells of the chunk, the origin is its corner
+		spatial::WallGrid grid;
+
+		// Sorted by row then column, empty when the level has no PVS
+		std::vector<VisibleSet> pvs;
+	};
+
+
+	auto chunkCoordinate(const float position, const float chunkSize) -> int32_t
+	{
+		return (int32_t)std::floor(position / chunkSize);
+	}
+
+
+	// renderWalls draws every wall this tall, sprites reaching above it are seen over walls
+	constexpr float wallTop = 2.0f;
+
+
+	// Sampled PVS of the chunk at (x, y). Rays are cast in every direction from a grid of
+	// numSamples x numSamples points covering the chunk, its border included, and every wall
+	// in the grid cells around a hit is visible, so walls next to the one hit are kept too.
+	// A sprite is visible when one of the points has a clear line to its middle or its
+	// sides, or when it is tall enough to be seen over the walls. Walls only seen through
+	// gaps narrower than the spacing of the points or the rays can still be missed, see
+	// isVisibilityConverged.
+	auto buildVisibility(const LevelDescription& description, const spatial::WallGrid& grid, const int32_t x, const int32_t y, const uint32_t numSamples, const uint32_t numRays, std::vector<bool>& outWalls, std::vector<bool>& outSprites)
+	{
+		const float distance = description.pvsDistance;
+		const ds::Vec2 chunkMin = ds::Vec2((float)x, (float)y) * description.chunkSize;
+
+		std::fill(outWalls.begin(), outWalls.end(), false);
+		std::fill(outSprites.begin(), outSprites.end(), false);
+
+		for (uint32_t i = 0; i < numSamples; i++)
+		{
+			for (uint32_t j = 0; j < numSamples; j++)
+			{
+				const ds::Vec2 point = chunkMin + ds::Vec2((float)j, (float)i) / (float)(numSamples - 1) * description.chunkSize;
+
+				for (uint32_t r = 0; r < numRays; r++)
+				{
+					const float angle = (float)r / (float)numRays * 2.0f * glm::pi<float>();
+					const ds::Vec2 direction = ds::Vec2(std::cos(angle), std::sin(angle));
+					const std::optional hit = spatial::castRay(grid, point, direction, distance);
+
+					if (!hit.has_value())
+					{
+						continue;
+					}
+
+					outWalls[hit->wallIndex] = true;
+
+					const ds::Vec2 cell = (point + direction * hit->distance - grid.origin) / grid.cellSize;
+					const int64_t column = (int64_t)std::floor(cell.x);
+					const int64_t row = (int64_t)std::floor(cell.y);
+
+					for (int64_t _i = std::max<int64_t>(row - 1, 0); _i <= std::min<int64_t>(row + 1, (int64_t)grid.rows - 1); _i++)
+					{
+						for (int64_t _j = std::max<int64_t>(column - 1, 0); _j <= std::min<int64_t>(column + 1, (int64_t)grid.columns - 1); _j++)
+						{
+							const size_t index = (size_t)_i * grid.columns + (size_t)_j;
+
+							for (uint32_t k = grid.cellStart[index]; k < grid.cellStart[index + 1]; k++)
+							{
+								outWalls[grid.wallIndices[k]] = true;
+							}
+						}
+					}
+				}
+
+				for (size_t s = 0; s < description.sprites.size(); s++)
+				{
+					const rendering::Sprite& sprite = description.sprites[s];
+					const ds::Vec2 toSprite = sprite.position - point;
+					const float spriteDistance = glm::length(toSprite);
+
+					if (outSprites[s] || spriteDistance >= distance)
+					{
+						continue;
+					}
+
+					if (-sprite.height + sprite.size > wallTop || spriteDistance < 0.0001f)
+					{
+						outSprites[s] = true;
+						continue;
+					}
+
+					const ds::Vec2 side = ds::Vec2(-toSprite.y, toSprite.x) / spriteDistance * sprite.size;
+
+					for (const ds::Vec2 target : { sprite.position, sprite.position + side, sprite.position - side })
+					{
+						const ds::Vec2 toTarget = target - point;
+						const float targetDistance = glm::length(toTarget);
+
+						if (!spatial::castRay(grid, point, toTarget / targetDistance, targetDistance).has_value())
+						{
+							outSprites[s] = true;
+							break;
+						}
+					}
+				}
+			}
+		}
+	}
+
+
+	// Sampling the chunk again with the points and rays twice as dense must not find anything
+	// new, otherwise the walls seen through the gaps between the samples would be dropped
+	auto isVisibilityConverged(const std::vector<bool>& walls, const std::vector<bool>& sprites, const std::vector<bool>& denseWalls, const std::vector<bool>& denseSprites) -> bool
+	{
+		for (size_t i = 0; i < walls.size(); i++)
+		{
+			if (denseWalls[i] && !walls[i])
+			{
+				return false;
+			}
+		}
+
+		for (size_t i = 0; i < sprites.size(); i++)
+		{
+			if (denseSprites[i] && !sprites[i])
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+
+	auto cookLevel(const LevelDescription& description) -> std::vector<std::byte>
+	{
+		const float chunkSize = description.chunkSize;
+		const uint32_t cellsPerChunk = description.cellsPerChunk;
+
+		// Walls and sprites of each chunk as indices into the description, keyed by row
+		// then column so the chunks come out in table order
+		struct Members
+		{
+			std::vector<uint32_t> walls;
+			std::vector<uint32_t> sprites;
+		};
+
+		std::map<std::pair<int32_t, int32_t>, Members> members;
+
+		for (uint32_t w = 0; w < description.walls.size(); w++)
+		{
+			const wall::Wall& wall = description.walls[w];
+			const ds::Vec2 wallMin = glm::min(wall.line.start, wall.line.end) - ds::Vec2(spatial::gridPadding);
+			const ds::Vec2 wallMax = glm::max(wall.line.start, wall.line.end) + ds::Vec2(spatial::gridPadding);
+
+			for (int32_t y = chunkCoordinate(wallMin.y, chunkSize); y <= chunkCoordinate(wallMax.y, chunkSize); y++)
+			{
+				for (int32_t x = chunkCoordinate(wallMin.x, chunkSize); x <= chunkCoordinate(wallMax.x, chunkSize); x++)
+				{
+					const ds::Vec2 chunkMin = ds::Vec2((float)x, (float)y) * chunkSize - ds::Vec2(spatial::gridPadding);
+					const ds::Vec2 chunkMax = chunkMin + ds::Vec2(chunkSize + 2.0f * spatial::gridPadding);
+
+					if (spatial::segmentOverlapsCell(wall.line, chunkMin, chunkMax))
+					{
+						members[{ y, x }].walls.push_back(w);
+					}
+				}
+			}
+		}
+
+		std::vector<rendering::TextureId> spriteTextures;
+
+		for (uint32_t s = 0; s < description.sprites.size(); s++)
+		{
+			const rendering::Sprite& sprite = description.sprites[s];
+
+			members[{ chunkCoordinate(sprite.position.y, chunkSize), chunkCoordinate(sprite.position.x, chunkSize) }].sprites.push_back(s);
+
+			if (std::find(spriteTextures.begin(), spriteTextures.end(), sprite.texture) == spriteTextures.end())
+			{
+				spriteTextures.push_back(sprite.texture);
+			}
+		}
+
+		const bool buildPvs = description.buildPvs && !members.empty();
+
+		// The camera can stand in an empty chunk, so with a PVS every chunk over the bounds
+		// gets one. Outside the bounds the streamer shows everything.
+		if (buildPvs)
+		{
+			int32_t left = members.begin()->first.second;
+			int32_t right = left;
+			const int32_t top = members.begin()->first.first;
+			const int32_t bottom = members.rbegin()->first.first;
+
+			for (const auto& [key, chunkMembers] : members)
+			{
+				left = std::min(left, key.second);
+				right = std::max(right, key.second);
+			}
+
+			for (int32_t y = top; y <= bottom; y++)
+			{
+				for (int32_t x = left; x <= right; x++)
+				{
+					members.try_emplace({ y, x });
+				}
+			}
+		}
+
+		std::vector<Chunk> chunks;
+		chunks.reserve(members.size());
+
+		for (const auto& [key, chunkMembers] : members)
+		{
+			Chunk& chunk = chunks.emplace_back();
+			chunk.x = key.second;
+			chunk.y = key.first;
+
+			for (const uint32_t w : chunkMembers.walls)
+			{
+				chunk.walls.push_back(description.walls[w]);
+			}
+
+			for (const uint32_t s : chunkMembers.sprites)
+			{
+				chunk.sprites.push_back(description.sprites[s]);
+			}
+
+			chunk.grid.origin = ds::Vec2((float)chunk.x, (float)chunk.y) * chunkSize;
+			chunk.grid.cellSize = chunkSize / (float)cellsPerChunk;
+			chunk.grid.columns = cellsPerChunk;
+			chunk.grid.rows = cellsPerChunk;
+
+			spatial::fillWallGrid(chunk.grid, chunk.walls);
+		}
+
+		if (buildPvs)
+		{
+			const spatial::WallGrid levelGrid = spatial::buildWallGrid(description.walls);
+
+			std::vector<bool> visibleWalls(description.walls.size());
+			std::vector<bool> visibleSprites(description.sprites.size());
+			std::vector<bool> denseWalls(description.walls.size());
+			std::vector<bool> denseSprites(description.sprites.size());
+
+			for (auto& chunk : chunks)
+			{
+				buildVisibility(description, levelGrid, chunk.x, chunk.y, description.pvsSamples, description.pvsRays, visibleWalls, visibleSprites);
+				buildVisibility(description, levelGrid, chunk.x, chunk.y, 2 * description.pvsSamples - 1, 2 * description.pvsRays, denseWalls, denseSprites);
+
+				// A chunk without visible sets draws everything in the window, see ChunkStreamer::merge
+				if (!isVisibilityConverged(visibleWalls, visibleSprites, denseWalls, denseSprites))
+				{
+					continue;
+				}
+
+				// The walls of the chunk itself are always kept, the camera can stand right next to them
+				for (const uint32_t w : members[{ chunk.y, chunk.x }].walls)
+				{
+					visibleWalls[w] = true;
+				}
+
+				for (const auto& [key, chunkMembers] : members)
+				{
+					VisibleSet visible{ key.second, key.first };
+
+					for (uint32_t i = 0; i < chunkMembers.walls.size(); i++)
+					{
+						if (visibleWalls[chunkMembers.walls[i]])
+						{
+							visible.walls.push_back(i);
+						}
+					}
+
+					for (uint32_t i = 0; i < chunkMembers.sprites.size(); i++)
+					{
+						if (visibleSprites[chunkMembers.sprites[i]])
+						{
+							visible.sprites.push_back(i);
+						}
+					}
+
+					if (!visible.walls.empty() || !visible.sprites.empty())
+					{
+						chunk.pvs.push_back(std::move(visible));
+					}
+				}
+			}
+		}
+
+		std::vector<std::byte> bytes;
+
+		const auto append = [&](const void* p_data, const size_t size)
+			{
+				const std::byte* p_bytes = static_cast<const std::byte*>(p_data);
+				bytes.insert(bytes.end(), p_bytes, p_bytes + size);
+			};
+
+		const auto appendVector = [&](const auto& values)
+			{
+				append(values.data(), values.size() * sizeof(values[0]));
+			};
+
+		CookedHeader header{};
+		std::memcpy(header.magic, cookedMagic, sizeof(cookedMagic));
+		header.version = cookedVersion;
+		header.chunkSize = chunkSize;
+		header.cellsPerChunk = cellsPerChunk;
+		header.chunkCount = (uint32_t)chunks.size();
+		header.texturesLength = (uint32_t)description.texturesFilename.size();
+		header.spriteTextureCount = (uint32_t)spriteTextures.size();
+		header.flags = buildPvs ? hasPvsFlag : 0;
+
+		append(&header, sizeof(header));
+		append(description.texturesFilename.data(), description.texturesFilename.size());
+		appendVector(spriteTextures);
+
+		const size_t tableOffset = bytes.size();
+		bytes.resize(bytes.size() + chunks.size() * sizeof(CookedChunk));
+
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			const Chunk& chunk = chunks[i];
+			const size_t offset = bytes.size();
+
+			for (const auto& wall : chunk.walls)
+			{
+				const CookedWall cooked{ wall.line.start.x, wall.line.start.y, wall.line.end.x, wall.line.end.y, wall.height, { wall.color.r, wall.color.g, wall.color.b }, wall.material };
+				append(&cooked, sizeof(cooked));
+			}
+
+			for (const auto& sprite : chunk.sprites)
+			{
+				const CookedSprite cooked{ sprite.texture, sprite.position.x, sprite.position.y, sprite.size, sprite.height };
+				append(&cooked, sizeof(cooked));
+			}
+
+			appendVector(chunk.grid.cellStart);
+			appendVector(chunk.grid.wallIndices);
+			appendVector(chunk.grid.startX);
+			appendVector(chunk.grid.startY);
+			appendVector(chunk.grid.edgeX);
+			appendVector(chunk.grid.edgeY);
+			appendVector(chunk.grid.edgeLength);
+
+			const size_t pvsOffset = bytes.size();
+
+			for (const auto& visible : chunk.pvs)
+			{
+				const CookedVisibleSet cooked{ visible.x, visible.y, (uint32_t)visible.walls.size(), (uint32_t)visible.sprites.size() };
+				append(&cooked, sizeof(cooked));
+				appendVector(visible.walls);
+				appendVector(visible.sprites);
+			}
+
+			const CookedChunk entry{ chunk.x, chunk.y, offset, (uint32_t)chunk.walls.size(), (uint32_t)chunk.sprites.size(), (uint32_t)chunk.grid.wallIndices.size(), (uint32_t)(bytes.size() - pvsOffset) };
+			std::memcpy(bytes.data() + tableOffset + i * sizeof(CookedChunk), &entry, sizeof(entry));
+		}
+
+		return bytes;
+	}
+
+
+	auto writeCookedLevel(const LevelDescription& description, const std::string& filename) -> std::expected<void, std::string>
+	{
+		const std::vector<std::byte> bytes = cookLevel(description);
+
+		std::ofstream fileStream(filename, std::ios::binary | std::ios::trunc);
+
+		if (!fileStream.is_open())
+		{
+			return std::unexpected(std::format("Failed to create file '{}'", filename));
+		}
+
+		fileStream.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+
+		if (!fileStream.good())
+		{
+			return std::unexpected(std::format("Failed to write file '{}'", filename));
+		}
+
+		return {};
+	}
+
+
+	// Cooked level with its chunk table, the chunks themselves are only read when they are
+	// decoded. storage owns the bytes, either the mapped file or a level cooked in memory.
+	struct Level
+	{
+		// Texture manifest, relative to the working directory
+		std::string texturesFilename;
+		std::vector<rendering::TextureId> spriteTextures;
+
+		float chunkSize;
+		uint32_t cellsPerChunk;
+		bool hasPvs;
+
+		std::vector<CookedChunk> chunks;
+
+		const std::byte* p_data;
+		size_t size;
+		std::shared_ptr<const void> storage;
+	};
+
+
+	// Checks the header and the chunk table, directory is where the manifest name is relative to
+	auto parseLevel(std::shared_ptr<const void> storage, const std::byte* p_data, const size_t size, const std::string& name, const std::filesystem::path& directory) -> std::expected<Level, std::string>
+	{
+		CookedHeader header;
+
+		if (size < sizeof(header))
+		{
+			return std::unexpected(std::format("Cooked level '{}' is truncated", name));
+		}
+
+		std::memcpy(&header, p_data, sizeof(header));
+
+		if (std::memcmp(header.magic, cookedMagic, sizeof(cookedMagic)) != 0 || header.version != cookedVersion)
+		{
+			return std::unexpected(std::format("File '{}' is not a cooked level of version {}", name, cookedVersion));
+		}
+
+		if (!(header.chunkSize > 0.0f) || header.cellsPerChunk == 0 || header.cellsPerChunk > 256)
+		{
+			return std::unexpected(std::format("Invalid chunk layout in cooked level '{}'", name));
+		}
+
+		const uint64_t tableOffset = sizeof(header) + (uint64_t)header.texturesLength + (uint64_t)header.spriteTextureCount * sizeof(rendering::TextureId);
+
+		if (tableOffset + (uint64_t)header.chunkCount * sizeof(CookedChunk) > size)
+		{
+			return std::unexpected(std::format("Invalid chunk table in cooked level '{}'", name));
+		}
+
+		Level level{};
+		level.chunkSize = header.chunkSize;
+		level.cellsPerChunk = header.cellsPerChunk;
+		level.hasPvs = (header.flags & hasPvsFlag) != 0;
+
+		const std::string texturesFilename(reinterpret_cast<const char*>(p_data + sizeof(header)), header.texturesLength);
+		level.texturesFilename = (directory / texturesFilename).lexically_normal().string();
+
+		level.spriteTextures.resize(header.spriteTextureCount);
+		std::memcpy(level.spriteTextures.data(), p_data + sizeof(header) + header.texturesLength, level.spriteTextures.size() * sizeof(rendering::TextureId));
+
+		level.chunks.resize(header.chunkCount);
+		std::memcpy(level.chunks.data(), p_data + tableOffset, level.chunks.size() * sizeof(CookedChunk));
+
+		for (size_t i = 0; i < level.chunks.size(); i++)
+		{
+			const CookedChunk& chunk = level.chunks[i];
+
+			if (chunk.offset > size || cookedChunkSize(chunk, level.cellsPerChunk) > size - chunk.offset)
+			{
+				return std::unexpected(std::format("Chunk {} of cooked level '{}' is out of bounds", i, name));
+			}
+
+			if (i > 0 && std::tie(level.chunks[i - 1].y, level.chunks[i - 1].x) >= std::tie(chunk.y, chunk.x))
+			{
+				return std::unexpected(std::format("Chunks of cooked level '{}' are not sorted", name));
+			}
+		}
+
+		level.p_data = p_data;
+		level.size = size;
+		level.storage = std::move(storage);
+
+		return level;
+	}
+
+
+	// Loads a cooked level, or a JSON level cooked in memory. A JSON level is replaced by the
+	// .rclevel file next to it when that is not older, or when the JSON file is missing.
+	auto loadLevel(const std::string& filename) -> std::expected<Level, std::string>
+	{
+		const std::filesystem::path path(filename);
+		const std::filesystem::path directory = path.parent_path();
+
+		std::filesystem::path cookedPath = path;
+
+		if (path.extension() == ".json")
+		{
+			cookedPath.replace_extension(".rclevel");
+
+			if (!media::preferCooked(cookedPath, path))
+			{
+				auto description = loadLevelDescription(filename);
+
+				if (!description.has_value())
+				{
+					return std::unexpected(description.error());
+				}
+
+				auto p_bytes = std::make_shared<std::vector<std::byte>>(cookLevel(description.value()));
+
+				return parseLevel(p_bytes, p_bytes->data(), p_bytes->size(), filename, directory);
+			}
+		}
+
+		auto mapped = media::MappedFile::open(cookedPath.string());
+
+		if (!mapped.has_value())
+		{
+			return std::unexpected(mapped.error());
+		}
+
+		auto p_file = std::make_shared<media::MappedFile>(std::move(mapped.value()));
+
+		return parseLevel(p_file, p_file->data(), p_file->size(), cookedPath.string(), directory);
+	}
+
+
+	// Copies chunk index of the table out of the level. Grid indices are checked, so a
+	// corrupt chunk can not make castRay read past its walls.
+	auto decodeChunk(const Level& level, const size_t index, Chunk& outChunk) -> std::expected<void, std::string>
+	{
+		const CookedChunk& entry = level.chunks[index];
+		const std::byte* p_read = level.p_data + entry.offset;
+
+		const auto read = [&](auto& values, const size_t count)
+			{
+				values.resize(count);
+				std::memcpy(values.data(), p_read, count * sizeof(values[0]));
+				p_read += count * sizeof(values[0]);
+			};
+
+		outChunk.x = entry.x;
+		outChunk.y = entry.y;
+
+		outChunk.walls.clear();
+		outChunk.walls.reserve(entry.wallCount);
+
+		for (uint32_t i = 0; i < entry.wallCount; i++)
+		{
+			CookedWall cooked;
+			std::memcpy(&cooked, p_read, sizeof(cooked));
+			p_read += sizeof(cooked);
+
+			outChunk.walls.emplace_back(ds::Vec2(cooked.startX, cooked.startY), ds::Vec2(cooked.endX, cooked.endY), cooked.height,
+				ds::ColorRGB(cooked.color[0], cooked.color[1], cooked.color[2]), cooked.material);
+		}
+
+		outChunk.sprites.resize(entry.spriteCount);
+
+		for (auto& sprite : outChunk.sprites)
+		{
+			CookedSprite cooked;
+			std::memcpy(&cooked, p_read, sizeof(cooked));
+			p_read += sizeof(cooked);
+
+			sprite = rendering::Sprite{ cooked.texture, ds::Vec2(cooked.x, cooked.y), cooked.size, cooked.height };
+		}
+
+		spatial::WallGrid& grid = outChunk.grid;
+		grid.origin = ds::Vec2((float)entry.x, (float)entry.y) * level.chunkSize;
+		grid.cellSize = level.chunkSize / (float)level.cellsPerChunk;
+		grid.columns = level.cellsPerChunk;
+		grid.rows = level.cellsPerChunk;
+
+		read(grid.cellStart, grid.columns * grid.rows + 1);
+		read(grid.wallIndices, entry.entryCount);
+		read(grid.startX, entry.entryCount);
+		read(grid.startY, entry.entryCount);
+		read(grid.edgeX, entry.entryCount);
+		read(grid.edgeY, entry.entryCount);
+		read(grid.edgeLength, entry.entryCount);
+
+		const bool validCells = grid.cellStart.front() == 0 && grid.cellStart.back() == entry.entryCount
+			&& std::is_sorted(grid.cellStart.begin(), grid.cellStart.end())
+			&& std::all_of(grid.cellStart.begin(), grid.cellStart.end(), [](const uint32_t start) { return start % spatial::wallLaneWidth == 0; });
+
+		const bool validWalls = std::all_of(grid.wallIndices.begin(), grid.wallIndices.end(), [&](const uint32_t wall) { return wall < entry.wallCount; });
+
+		if (!validCells || !validWalls)
+		{
+			outChunk.walls.clear();
+			outChunk.sprites.clear();
+			grid.cellStart.assign(grid.columns * grid.rows + 1, 0);
+
+			return std::unexpected(std::format("Chunk ({}, {}) of the level has an invalid grid", entry.x, entry.y));
+		}
+
+		// Indices into other chunks are checked when they are merged
+		const std::byte* p_pvsEnd = p_read + entry.pvsSize;
+		size_t numVisible = 0;
+		bool validPvs = true;
+
+		while (p_read < p_pvsEnd)
+		{
+			CookedVisibleSet cooked;
+
+			if ((size_t)(p_pvsEnd - p_read) < sizeof(cooked))
+			{
+				validPvs = false;
+				break;
+			}
+
+			std::memcpy(&cooked, p_read, sizeof(cooked));
+			p_read += sizeof(cooked);
+
+			if (((uint64_t)cooked.wallCount + cooked.spriteCount) * sizeof(uint32_t) > (uint64_t)(p_pvsEnd - p_read))
+			{
+				validPvs = false;
+				break;
+			}
+
+			if (numVisible == outChunk.pvs.size())
+			{
+				outChunk.pvs.emplace_back();
+			}
+
+			VisibleSet& visible = outChunk.pvs[numVisible++];
+			visible.x = cooked.x;
+			visible.y = cooked.y;
+
+			read(visible.walls, cooked.wallCount);
+			read(visible.sprites, cooked.spriteCount);
+		}
+
+		outChunk.pvs.resize(numVisible);
+
+		validPvs = validPvs && std::is_sorted(outChunk.pvs.begin(), outChunk.pvs.end(),
+			[](const VisibleSet& a, const VisibleSet& b) { return std::tie(a.y, a.x) < std::tie(b.y, b.x); });
+
+		if (!validPvs)
+		{
+			outChunk.pvs.clear();
+
+			return std::unexpected(std::format("Chunk ({}, {}) of the level has an invalid PVS, everything around it is drawn", entry.x, entry.y));
+		}
+
+		return {};
+	}
+
+
+	// Keeps the chunks around the camera decoded and merges them into the scene the passes
+	// render. Decoding and merging run on the pool while frames are rendered from the last
+	// merged scene, which is swapped in by update between two frames.
+	class ChunkStreamer
+	{
+	public:
+
+		// Chunks up to loadRadius chunks away from the one holding the camera are rendered,
+		// those up to keepRadius stay decoded so walking back and forth over a chunk border
+		// does not decode anything. Memory is bounded by the chunks within keepRadius. Both
+		// are derived from the view distance by the constructor, keepRadius has to stay above
+		// loadRadius.
+		int32_t loadRadius;
+		int32_t keepRadius;
+
+	private:
+
+		// Chunks [left, right) x [top, bottom)
+		struct Window
+		{
+			int32_t left;
+			int32_t top;
+			int32_t right;
+			int32_t bottom;
+
+			auto operator==(const Window&) const -> bool = default;
+		};
+
+		const Level& m_level;
+		threading::ThreadPool& m_pool;
+
+		std::array<scene::Scene, 2> m_scenes;
+		size_t m_front = 0;
+		size_t m_sceneVersion = 0;
+
+		Window m_window = Window{ 0, 0, 0, 0 };
+		Window m_pendingWindow = Window{ 0, 0, 0, 0 };
+
+		// Only touched by the load job while one is running
+		std::vector<Chunk> m_resident;
+		std::vector<size_t> m_missing;
+		std::vector<const Chunk*> m_windowChunks;
+		std::vector<uint32_t> m_remapStart;
+		std::vector<uint32_t> m_wallRemap;
+
+		threading::JobHandle m_job;
+		bool m_loading = false;
+
+		auto findChunk(const int32_t x, const int32_t y) const -> std::optional<size_t>
+		{
+			const auto it = std::lower_bound(m_level.chunks.begin(), m_level.chunks.end(), std::tie(y, x),
+				[](const CookedChunk& chunk, const auto& key) { return std::tie(chunk.y, chunk.x) < key; });
+
+			if (it == m_level.chunks.end() || it->x != x || it->y != y)
+			{
+				return std::nullopt;
+			}
+
+			return (size_t)(it - m_level.chunks.begin());
+		}
+
+		static auto contains(const Window& window, const int32_t x, const int32_t y) -> bool
+		{
+			return x >= window.left && x < window.right && y >= window.top && y < window.bottom;
+		}
+
+		// Concatenates the walls and sprites of the chunks in window into the back scene and
+		// lays their grids side by side, so the merged grid is copied and never rebuilt. With
+		// a PVS only the walls and sprites the chunk holding the camera may see are kept.
+		auto merge(const Window& window)
+		{
+			constexpr uint32_t hidden = std::numeric_limits<uint32_t>::max();
+
+			scene::Scene& target = m_scenes[1 - m_front];
+			spatial::WallGrid& grid = target.wallGrid;
+
+			const size_t windowColumns = (size_t)(window.right - window.left);
+			const size_t windowRows = (size_t)(window.bottom - window.top);
+			const size_t cellsPerChunk = m_level.cellsPerChunk;
+
+			m_windowChunks.assign(windowColumns * windowRows, nullptr);
+			m_remapStart.assign(windowColumns * windowRows, 0);
+			m_wallRemap.clear();
+
+			target.walls.clear();
+			target.sprites.clear();
+
+			for (const auto& chunk : m_resident)
+			{
+				if (contains(window, chunk.x, chunk.y))
+				{
+					m_windowChunks[(size_t)(chunk.y - window.top) * windowColumns + (size_t)(chunk.x - window.left)] = &chunk;
+				}
+			}
+
+			// The window is centered on the chunk holding the camera. Without a PVS there, as
+			// outside the bounds of the level, everything in the window is drawn.
+			const Chunk* p_center = m_windowChunks[(windowRows / 2) * windowColumns + windowColumns / 2];
+			const std::vector<VisibleSet>* p_pvs = m_level.hasPvs && p_center && !p_center->pvs.empty() ? &p_center->pvs : nullptr;
+
+			for (size_t i = 0; i < m_windowChunks.size(); i++)
+			{
+				const Chunk* p_chunk = m_windowChunks[i];
+
+				if (!p_chunk)
+				{
+					continue;
+				}
+
+				m_remapStart[i] = (uint32_t)m_wallRemap.size();
+
+				if (!p_pvs)
+				{
+					for (size_t w = 0; w < p_chunk->walls.size(); w++)
+					{
+						m_wallRemap.push_back((uint32_t)(target.walls.size() + w));
+					}
+
+					target.walls.insert(target.walls.end(), p_chunk->walls.begin(), p_chunk->walls.end());
+					target.sprites.insert(target.sprites.end(), p_chunk->sprites.begin(), p_chunk->sprites.end());
+					continue;
+				}
+
+				const auto visible = std::lower_bound(p_pvs->begin(), p_pvs->end(), std::tie(p_chunk->y, p_chunk->x),
+					[](const VisibleSet& set, const auto& key) { return std::tie(set.y, set.x) < key; });
+
+				if (visible == p_pvs->end() || visible->x != p_chunk->x || visible->y != p_chunk->y)
+				{
+					m_windowChunks[i] = nullptr;
+					continue;
+				}
+
+				m_wallRemap.resize(m_wallRemap.size() + p_chunk->walls.size(), hidden);
+
+				for (const uint32_t w : visible->walls)
+				{
+					if (w < p_chunk->walls.size() && m_wallRemap[m_remapStart[i] + w] == hidden)
+					{
+						m_wallRemap[m_remapStart[i] + w] = (uint32_t)target.walls.size();
+						target.walls.push_back(p_chunk->walls[w]);
+					}
+				}
+
+				for (const uint32_t s : visible->sprites)
+				{
+					if (s < p_chunk->sprites.size())
+					{
+						target.sprites.push_back(p_chunk->sprites[s]);
+					}
+				}
+			}
+
+			grid.origin = ds::Vec2((float)window.left, (float)window.top) * m_level.chunkSize;
+			grid.cellSize = m_level.chunkSize / (float)cellsPerChunk;
+			grid.columns = windowColumns * cellsPerChunk;
+			grid.rows = windowRows * cellsPerChunk;
+
+			grid.cellStart.clear();
+			grid.wallIndices.clear();
+			grid.startX.clear();
+			grid.startY.clear();
+			grid.edgeX.clear();
+			grid.edgeY.clear();
+			grid.edgeLength.clear();
+
+			const auto pushEntry = [&](const uint32_t wall, const float startX, const float startY, const float edgeX, const float edgeY, const float edgeLength)
+				{
+					grid.wallIndices.push_back(wall);
+					grid.startX.push_back(startX);
+					grid.startY.push_back(startY);
+					grid.edgeX.push_back(edgeX);
+					grid.edgeY.push_back(edgeY);
+					grid.edgeLength.push_back(edgeLength);
+				};
+
+			for (size_t row = 0; row < grid.rows; row++)
+			{
+				for (size_t column = 0; column < grid.columns; column++)
+				{
+					const uint32_t cellBegin = (uint32_t)grid.wallIndices.size();
+					grid.cellStart.push_back(cellBegin);
+
+					const size_t windowIndex = (row / cellsPerChunk) * windowColumns + column / cellsPerChunk;
+					const Chunk* p_chunk = m_windowChunks[windowIndex];
+
+					if (!p_chunk)
+					{
+						continue;
+					}
+
+					const spatial::WallGrid& source = p_chunk->grid;
+					const size_t cell = (row % cellsPerChunk) * cellsPerChunk + column % cellsPerChunk;
+
+					for (uint32_t k = source.cellStart[cell]; k < source.cellStart[cell + 1]; k++)
+					{
+						const uint32_t wall = m_wallRemap[m_remapStart[windowIndex] + source.wallIndices[k]];
+
+						// Padding is added back below, once the hidden walls are gone
+						if (wall != hidden && source.edgeLength[k] > 0.0f)
+						{
+							pushEntry(wall, source.startX[k], source.startY[k], source.edgeX[k], source.edgeY[k], source.edgeLength[k]);
+						}
+					}
+
+					while ((grid.wallIndices.size() - cellBegin) % spatial::wallLaneWidth != 0)
+					{
+						pushEntry(0, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+					}
+				}
+			}
+
+			grid.cellStart.push_back((uint32_t)grid.wallIndices.size());
+		}
+
+
+		auto load()
+		{
+			const Window window = m_pendingWindow;
+			const int32_t margin = std::max(0, keepRadius - loadRadius);
+			const Window keep = Window{ window.left - margin, window.top - margin, window.right + margin, window.bottom + margin };
+
+			std::erase_if(m_resident, [&](const Chunk& chunk) { return !contains(keep, chunk.x, chunk.y); });
+
+			m_missing.clear();
+
+			for (int32_t y = window.top; y < window.bottom; y++)
+			{
+				for (int32_t x = window.left; x < window.right; x++)
+				{
+					const auto index = findChunk(x, y);
+					const bool resident = std::any_of(m_resident.begin(), m_resident.end(), [&](const Chunk& chunk) { return chunk.x == x && chunk.y == y; });
+
+					if (index.has_value() && !resident)
+					{
+						m_missing.push_back(index.value());
+					}
+				}
+			}
+
+			const size_t firstNew = m_resident.size();
+			m_resident.resize(firstNew + m_missing.size());
+
+			auto decode = [&](size_t start, size_t end)
+				{
+					for (size_t i = start; i < end; i++)
+					{
+						auto result = decodeChunk(m_level, m_missing[i], m_resident[firstNew + i]);
+
+						if (!result.has_value())
+						{
+							std::cout << result.error() << "\n";
+						}
+					}
+				};
+
+			m_pool.parallelFor(m_missing.size(), 1, decode);
+
+			merge(window);
+		}
+
+		// Callable handed to the pool, dispatch keeps a pointer to it
+		struct LoadJob
+		{
+			ChunkStreamer* p_streamer;
+
+			auto operator()(size_t, size_t) const
+			{
+				p_streamer->load();
+			}
+		};
+
+		LoadJob m_loadJob{ this };
+
+		auto windowAround(const ds::Vec2 position) const -> Window
+		{
+			const int32_t x = chunkCoordinate(position.x, m_level.chunkSize);
+			const int32_t y = chunkCoordinate(position.y, m_level.chunkSize);
+
+			return Window{ x - loadRadius, y - loadRadius, x + loadRadius + 1, y + loadRadius + 1 };
+		}
+
+	public:
+
+		// Every chunk a ray of viewDistance cast from the chunk holding the camera can reach
+		// is loaded, so the far plane of the cameras is a good choice
+		ChunkStreamer(const Level& level, threading::ThreadPool& pool, const float viewDistance) :
+			loadRadius(std::max(1, (int32_t)std::ceil(viewDistance / level.chunkSize))),
+			keepRadius(loadRadius + 1),
+			m_level(level),
+			m_pool(pool)
+		{
+			for (auto& scene : m_scenes)
+			{
+				scene.wallGrid = spatial::buildWallGrid(scene.walls);
+			}
+		}
+
+		ChunkStreamer(const ChunkStreamer&) = delete;
+		ChunkStreamer& operator=(const ChunkStreamer&) = delete;
+
+		~ChunkStreamer()
+		{
+			if (m_loading)
+			{
+				m_pool.wait(m_job);
+			}
+		}
+
+		// Scene merged from the chunks around the camera at the last finished load
+		auto currentScene() const -> const scene::Scene&
+		{
+			return m_scenes[m_front];
+		}
+
+		// Changes every time another scene is swapped in
+		auto sceneVersion() const -> size_t
+		{
+			return m_sceneVersion;
+		}
+
+		auto isLoading() const -> bool
+		{
+			return m_loading;
+		}
+
+		// Swaps in a finished load and starts the next one when the camera moved to another
+		// chunk. Called between two frames, frames must not read currentScene() meanwhile.
+		auto update(const ds::Vec2 cameraPosition)
+		{
+			if (m_loading && m_job.isDone())
+			{
+				m_pool.wait(m_job);
+				m_front = 1 - m_front;
+				m_sceneVersion++;
+				m_window = m_pendingWindow;
+				m_loading = false;
+			}
+
+			const Window window = windowAround(cameraPosition);
+
+			if (m_loading || window == m_window)
+			{
+				return;
+			}
+
+			m_pendingWindow = window;
+			m_loading = true;
+			m_pool.dispatch(m_job, 1, 1, m_loadJob);
+		}
+
+		// Blocks until the chunks around cameraPosition are in currentScene(), used before the
+		// first frame
+		auto loadNow(const ds::Vec2 cameraPosition)
+		{
+			update(cameraPosition);
+
+			while (m_loading)
+			{
+				m_pool.wait(m_job);
+				update(cameraPosition);
+			}
+		}
+	};
+}
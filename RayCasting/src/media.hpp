@@ -5,6 +5,21 @@
 #include <string>
 #include <expected>
 #include <format>
+#include <cstddef>
+#include <utility>
+#include <filesystem>
+#include <system_error>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "ds.hpp"
 
@@ -12,7 +27,7 @@ namespace media
 {
 	struct Image
 	{
-		std::vector<ds::ColorRGBA> data;
+		std::vector<ds::PackedColor> data;
 
 		size_t width;
 		size_t height;
@@ -51,6 +66,206 @@ namespace media
 	};
 
 
+	// Non owning view of an image, the pixels can live in an Image or in a mapped file
+	struct ImageView
+	{
+		const ds::PackedColor* data;
+
+		size_t width;
+		size_t height;
+
+		ImageView(const ds::PackedColor* data, size_t width, size_t height) :
+			data(data), width(width), height(height)
+		{
+		}
+
+		ImageView(const Image& image) :
+			data(image.data.data()), width(image.width), height(image.height)
+		{
+		}
+	};
+
+
+	// Read only memory mapping of a whole file, unmapped on destruction
+	class MappedFile
+	{
+	private:
+
+		const std::byte* m_data = nullptr;
+		size_t m_size = 0;
+
+#if defined(_WIN32)
+		HANDLE m_file = INVALID_HANDLE_VALUE;
+		HANDLE m_mapping = nullptr;
+#endif
+
+		auto release()
+		{
+#if defined(_WIN32)
+			if (m_data != nullptr)
+			{
+				UnmapViewOfFile(m_data);
+			}
+			if (m_mapping != nullptr)
+			{
+				CloseHandle(m_mapping);
+			}
+			if (m_file != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(m_file);
+			}
+
+			m_file = INVALID_HANDLE_VALUE;
+			m_mapping = nullptr;
+#else
+			if (m_data != nullptr)
+			{
+				munmap(const_cast<std::byte*>(m_data), m_size);
+			}
+#endif
+
+			m_data = nullptr;
+			m_size = 0;
+		}
+
+		MappedFile() = default;
+
+	public:
+
+		static auto open(const std::string& filename) -> std::expected<MappedFile, std::string>
+		{
+			MappedFile file;
+
+#if defined(_WIN32)
+			file.m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+			if (file.m_file == INVALID_HANDLE_VALUE)
+			{
+				return std::unexpected(std::format("Failed to open file '{}'", filename));
+			}
+
+			LARGE_INTEGER fileSize;
+
+			if (!GetFileSizeEx(file.m_file, &fileSize) || fileSize.QuadPart == 0)
+			{
+				return std::unexpected(std::format("File '{}' is empty", filename));
+			}
+
+			file.m_mapping = CreateFileMappingA(file.m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+			if (file.m_mapping == nullptr)
+			{
+				return std::unexpected(std::format("Failed to map file '{}'", filename));
+			}
+
+			file.m_data = static_cast<const std::byte*>(MapViewOfFile(file.m_mapping, FILE_MAP_READ, 0, 0, 0));
+			file.m_size = (size_t)fileSize.QuadPart;
+#else
+			const int descriptor = ::open(filename.c_str(), O_RDONLY);
+
+			if (descriptor < 0)
+			{
+				return std::unexpected(std::format("Failed to open file '{}'", filename));
+			}
+
+			struct stat fileStatus;
+
+			if (fstat(descriptor, &fileStatus) != 0 || fileStatus.st_size == 0)
+			{
+				close(descriptor);
+				return std::unexpected(std::format("File '{}' is empty", filename));
+			}
+
+			void* p_mapping = mmap(nullptr, (size_t)fileStatus.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+			// The mapping keeps its own reference to the file
+			close(descriptor);
+
+			if (p_mapping == MAP_FAILED)
+			{
+				return std::unexpected(std::format("Failed to map file '{}'", filename));
+			}
+
+			file.m_data = static_cast<const std::byte*>(p_mapping);
+			file.m_size = (size_t)fileStatus.st_size;
+#endif
+
+			if (file.m_data == nullptr)
+			{
+				return std::unexpected(std::format("Failed to map file '{}'", filename));
+			}
+
+			return file;
+		}
+
+		MappedFile(MappedFile&& other) noexcept
+		{
+			*this = std::move(other);
+		}
+
+		MappedFile& operator=(MappedFile&& other) noexcept
+		{
+			if (this != &other)
+			{
+				release();
+
+				m_data = std::exchange(other.m_data, nullptr);
+				m_size = std::exchange(other.m_size, 0);
+#if defined(_WIN32)
+				m_file = std::exchange(other.m_file, INVALID_HANDLE_VALUE);
+				m_mapping = std::exchange(other.m_mapping, nullptr);
+#endif
+			}
+
+			return *this;
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		~MappedFile()
+		{
+			release();
+		}
+
+		auto data() const -> const std::byte*
+		{
+			return m_data;
+		}
+
+		auto size() const -> size_t
+		{
+			return m_size;
+		}
+	};
+
+
+	// True when a cooked file should be loaded instead of its source: the source is gone, as
+	// in an install that only ships cooked assets, or it did not change after cooking
+	auto preferCooked(const std::filesystem::path& cookedPath, const std::filesystem::path& sourcePath) -> bool
+	{
+		std::error_code cookedError;
+		std::error_code sourceError;
+
+		if (!std::filesystem::exists(cookedPath, cookedError))
+		{
+			return false;
+		}
+
+		const bool hasSource = std::filesystem::exists(sourcePath, sourceError);
+
+		if (!hasSource && !sourceError)
+		{
+			return true;
+		}
+
+		const auto cookedTime = std::filesystem::last_write_time(cookedPath, cookedError);
+		const auto sourceTime = std::filesystem::last_write_time(sourcePath, sourceError);
+
+		return !cookedError && !sourceError && cookedTime >= sourceTime;
+	}
+
+
 	auto imageFromBitMapFile(const std::string& filename) -> std::expected<Image, std::string>
 	{
 		std::ifstream fileStream(filename, std::ios::binary);
@@ -139,7 +354,7 @@ namespace media
 				{
 					size_t rowOffset = i * rowSize;
 
-					auto color = ds::ColorRGBA(
+					auto color = ds::packColor(
 						buffer[rowOffset + j + 2], 
 						buffer[rowOffset + j + 1], 
 						buffer[rowOffset + j], 
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <memory>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <type_traits>
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+#include "simd.hpp"
+
+namespace memory
+{
+	// Bump allocator for scratch data that only lives during one frame. Everything is
+	// released at once by reset(). When a frame needs more than the capacity the extra
+	// requests get their own blocks, and the next reset grows the arena to fit them,
+	// so after the first frames no heap allocation happens.
+	class FrameArena
+	{
+	private:
+
+		using Block = std::vector<std::byte, simd::CacheLineAllocator<std::byte>>;
+
+		Block m_block;
+		size_t m_offset = 0;
+
+		std::vector<Block> m_overflowBlocks;
+		size_t m_overflowBytes = 0;
+
+	public:
+
+		explicit FrameArena(size_t capacity) :
+			m_block(capacity)
+		{
+		}
+
+		// Uninitialized storage for count elements, alignment must be a power of two
+		// not larger than a cache line.
+		template <typename T>
+		auto allocate(size_t count, size_t alignment = alignof(T)) -> std::span<T>
+		{
+			static_assert(std::is_trivially_destructible_v<T>, "Frame arena memory is never destroyed");
+
+			const size_t bytes = count * sizeof(T);
+			const size_t start = (m_offset + alignment - 1) & ~(alignment - 1);
+
+			if (start + bytes <= m_block.size())
+			{
+				m_offset = start + bytes;
+				return std::span<T>(reinterpret_cast<T*>(m_block.data() + start), count);
+			}
+
+			m_overflowBlocks.emplace_back(bytes);
+			m_overflowBytes += bytes + alignment;
+
+			return std::span<T>(reinterpret_cast<T*>(m_overflowBlocks.back().data()), count);
+		}
+
+		auto reset()
+		{
+			if (m_overflowBytes > 0)
+			{
+				m_block = Block(m_block.size() + m_overflowBytes);
+				m_overflowBlocks.clear();
+				m_overflowBytes = 0;
+			}
+
+			m_offset = 0;
+		}
+
+		auto capacity() const -> size_t
+		{
+			return m_block.size();
+		}
+	};
+
+
+	// Heap allocation counter, only active in builds with RAYCASTING_TRACK_ALLOCATIONS
+	// where the global operator new is replaced below.
+	inline std::atomic<size_t> g_allocationCount = 0;
+
+	auto allocationCount() -> size_t
+	{
+		return g_allocationCount.load(std::memory_order_relaxed);
+	}
+
+	constexpr auto isTrackingAllocations() -> bool
+	{
+#if defined(RAYCASTING_TRACK_ALLOCATIONS)
+		return true;
+#else
+		return false;
+#endif
+	}
+}
+
+
+#if defined(RAYCASTING_TRACK_ALLOCATIONS)
+
+void* operator new(size_t size)
+{
+	memory::g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+	if (void* p_memory = std::malloc(size == 0 ? 1 : size))
+	{
+		return p_memory;
+	}
+
+	throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	memory::g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+	const size_t align = static_cast<size_t>(alignment);
+
+#if defined(_MSC_VER)
+	void* p_memory = _aligned_malloc(size == 0 ? 1 : size, align);
+#else
+	void* p_memory = std::aligned_alloc(align, ((size + align - 1) / align) * align);
+#endif
+
+	if (p_memory)
+	{
+		return p_memory;
+	}
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p_memory) noexcept
+{
+	std::free(p_memory);
+}
+
+void operator delete(void* p_memory, size_t) noexcept
+{
+	std::free(p_memory);
+}
+
+void operator delete(void* p_memory, std::align_val_t) noexcept
+{
+#if defined(_MSC_VER)
+	_aligned_free(p_memory);
+#else
+	std::free(p_memory);
+#endif
+}
+
+void operator delete(void* p_memory, size_t, std::align_val_t alignment) noexcept
+{
+	operator delete(p_memory, alignment);
+}
+
+#endif
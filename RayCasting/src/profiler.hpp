@@ -0,0 +1,306 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <expected>
+#include <format>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#include <nlohmann/json.hpp>
+
+#include "threading.hpp"
+
+namespace profiler
+{
+	using Clock = std::chrono::steady_clock;
+
+	enum class Pass : size_t
+	{
+		Walls,
+		Resolve,
+		FloorAndCeiling,
+		Background,
+		Sprites,
+		Present,
+		Count
+	};
+
+	constexpr size_t passCount = (size_t)Pass::Count;
+
+	constexpr std::array<const char*, passCount> passNames =
+	{
+		"walls",
+		"resolve",
+		"floorAndCeiling",
+		"background",
+		"sprites",
+		"present",
+	};
+
+
+	// Times of one frame in milliseconds
+	struct FrameSample
+	{
+		float frameTime;
+		std::array<float, passCount> passTimes;
+	};
+
+	struct Percentiles
+	{
+		float p50;
+		float p95;
+		float p99;
+	};
+
+
+	// Keeps the last historySize frames for percentiles and the overlay, and streams every
+	// frame to a CSV file when one is open. Recording a frame does not allocate.
+	class Profiler
+	{
+	public:
+
+		static constexpr size_t historySize = 1024;
+
+	private:
+
+		std::vector<FrameSample> m_history = std::vector<FrameSample>(historySize);
+		size_t m_numFrames = 0;
+
+		FrameSample m_current{};
+		Clock::time_point m_frameStart = Clock::now();
+
+		// Pool busy time per thread slot, since the start and since the last resetWindow
+		Clock::time_point m_start = Clock::now();
+		Clock::time_point m_windowStart = Clock::now();
+		std::vector<std::chrono::nanoseconds> m_busyAtWindowStart;
+		std::vector<float> m_windowBusyFraction;
+		std::vector<float> m_totalBusyFraction;
+
+		std::ofstream m_csv;
+
+		mutable std::vector<float> m_scratch = std::vector<float>(historySize);
+
+		auto percentilesOf(auto&& valueOf) const -> Percentiles
+		{
+			const size_t count = std::min(m_numFrames, historySize);
+
+			if (count == 0)
+			{
+				return Percentiles{ 0.0f, 0.0f, 0.0f };
+			}
+
+			for (size_t i = 0; i < count; i++)
+			{
+				m_scratch[i] = valueOf(m_history[i]);
+			}
+
+			std::sort(m_scratch.begin(), m_scratch.begin() + count);
+
+			const auto at = [&](float p) { return m_scratch[std::min((size_t)(p * (float)count), count - 1)]; };
+
+			return Percentiles{ at(0.50f), at(0.95f), at(0.99f) };
+		}
+
+		auto resizeThreads(const size_t numThreads)
+		{
+			if (m_busyAtWindowStart.size() != numThreads)
+			{
+				m_busyAtWindowStart.assign(numThreads, std::chrono::nanoseconds(0));
+				m_windowBusyFraction.assign(numThreads, 0.0f);
+				m_totalBusyFraction.assign(numThreads, 0.0f);
+			}
+		}
+
+	public:
+
+		auto beginFrame()
+		{
+			m_current = FrameSample{};
+			m_frameStart = Clock::now();
+		}
+
+		// Safe to call from several threads, the passes of views rendered at the same time
+		// add up
+		auto record(const Pass pass, const Clock::duration elapsed)
+		{
+			std::atomic_ref<float>(m_current.passTimes[(size_t)pass]).fetch_add(std::chrono::duration<float, std::milli>(elapsed).count(), std::memory_order_relaxed);
+		}
+
+		auto endFrame(const threading::ThreadPool& pool)
+		{
+			m_current.frameTime = std::chrono::duration<float, std::milli>(Clock::now() - m_frameStart).count();
+
+			m_history[m_numFrames % historySize] = m_current;
+			m_numFrames += 1;
+
+			if (m_csv.is_open())
+			{
+				m_csv << m_numFrames << ',' << m_current.frameTime;
+
+				for (const float passTime : m_current.passTimes)
+				{
+					m_csv << ',' << passTime;
+				}
+
+				m_csv << '\n';
+			}
+
+			resizeThreads(pool.numThreads());
+
+			const auto now = Clock::now();
+			const float windowTime = std::chrono::duration<float>(now - m_windowStart).count();
+			const float totalTime = std::chrono::duration<float>(now - m_start).count();
+
+			for (size_t i = 0; i < pool.numThreads(); i++)
+			{
+				const auto busy = pool.busyTime(i);
+
+				m_windowBusyFraction[i] = windowTime > 0.0f ? std::chrono::duration<float>(busy - m_busyAtWindowStart[i]).count() / windowTime : 0.0f;
+				m_totalBusyFraction[i] = totalTime > 0.0f ? std::chrono::duration<float>(busy).count() / totalTime : 0.0f;
+			}
+		}
+
+		// Starts a new window for the busy fractions, called after each report
+		auto resetWindow(const threading::ThreadPool& pool)
+		{
+			resizeThreads(pool.numThreads());
+			m_windowStart = Clock::now();
+
+			for (size_t i = 0; i < m_busyAtWindowStart.size(); i++)
+			{
+				m_busyAtWindowStart[i] = pool.busyTime(i);
+			}
+		}
+
+		auto numFrames() const -> size_t
+		{
+			return m_numFrames;
+		}
+
+		// Sample of the frame framesAgo frames back, 0 being the last finished one
+		auto frame(size_t framesAgo) const -> const FrameSample&
+		{
+			return m_history[(m_numFrames - 1 - framesAgo) % historySize];
+		}
+
+		// Mean frame time of the last count frames, or of all of them when there are fewer
+		auto recentFrameTime(size_t count) const -> float
+		{
+			count = std::min({ count, m_numFrames, historySize });
+
+			if (count == 0)
+			{
+				return 0.0f;
+			}
+
+			float sum = 0.0f;
+
+			for (size_t i = 0; i < count; i++)
+			{
+				sum += frame(i).frameTime;
+			}
+
+			return sum / (float)count;
+		}
+
+		auto framePercentiles() const -> Percentiles
+		{
+			return percentilesOf([](const FrameSample& sample) { return sample.frameTime; });
+		}
+
+		auto passPercentiles(const Pass pass) const -> Percentiles
+		{
+			return percentilesOf([pass](const FrameSample& sample) { return sample.passTimes[(size_t)pass]; });
+		}
+
+		// Fraction of the time since the last resetWindow each thread slot ran tasks
+		auto busyFractions() const -> const std::vector<float>&
+		{
+			return m_windowBusyFraction;
+		}
+
+		auto openCsv(const std::string& filename) -> std::expected<void, std::string>
+		{
+			m_csv.open(filename, std::ios::trunc);
+
+			if (!m_csv.is_open())
+			{
+				return std::unexpected(std::format("Failed to create file '{}'", filename));
+			}
+
+			m_csv << "frame,frameTime";
+
+			for (const char* name : passNames)
+			{
+				m_csv << ',' << name;
+			}
+
+			m_csv << '\n';
+
+			return {};
+		}
+
+		// Percentiles of the frames in the history and busy time per thread since the start
+		auto writeJson(const std::string& filename) const -> std::expected<void, std::string>
+		{
+			const auto toJson = [](const Percentiles& p)
+				{
+					return nlohmann::json{ { "p50", p.p50 }, { "p95", p.p95 }, { "p99", p.p99 } };
+				};
+
+			nlohmann::json report;
+			report["frames"] = m_numFrames;
+			report["frameTime"] = toJson(framePercentiles());
+
+			for (size_t i = 0; i < passCount; i++)
+			{
+				report["passes"][passNames[i]] = toJson(passPercentiles((Pass)i));
+			}
+
+			report["threadBusyFraction"] = m_totalBusyFraction;
+
+			std::ofstream fileStream(filename, std::ios::trunc);
+
+			if (!fileStream.is_open())
+			{
+				return std::unexpected(std::format("Failed to create file '{}'", filename));
+			}
+
+			fileStream << report.dump(4) << '\n';
+
+			return {};
+		}
+	};
+
+
+	class ScopedTimer
+	{
+	private:
+
+		Profiler& m_profiler;
+		Pass m_pass;
+		Clock::time_point m_start;
+
+	public:
+
+		ScopedTimer(Profiler& profiler, const Pass pass) :
+			m_profiler(profiler),
+			m_pass(pass),
+			m_start(Clock::now())
+		{
+		}
+
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+		~ScopedTimer()
+		{
+			m_profiler.record(m_pass, Clock::now() - m_start);
+		}
+	};
+}
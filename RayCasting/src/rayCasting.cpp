@@ -1,4 +1,5 @@
-﻿#include <vector>
+#include <vector>
+#include <array>
 #include <numbers>
 #include <thread>
 #include <optional>
@@ -7,6 +8,11 @@
 #include <algorithm>
 #include <execution>
 #include <functional>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <expected>
+#include <format>
 
 #define GLM_ENABLE_EXPERIMENTAL
 
@@ -15,83 +21,27 @@
 #include <glm/gtx/matrix_transform_2d.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 
+#include <nlohmann/json.hpp>
+
 #include "sdl.hpp"
 #include "camera.hpp"
 #include "wall.hpp"
 #include "media.hpp"
 #include "rendering.hpp"
+#include "threading.hpp"
+#include "spatial.hpp"
+#include "simd.hpp"
+#include "memory.hpp"
+#include "sampler.hpp"
+#include "texture.hpp"
+#include "profiler.hpp"
+#include "renderPasses.hpp"
+#include "scene.hpp"
+#include "scaling.hpp"
+#include "level.hpp"
+#include "sector.hpp"
 
 
-enum class Orientation
-{
-	ClockWise,
-	CounterClockWise
-};
-
-
-auto executeInParallel(size_t numThreads, size_t dataSize, std::function<void(size_t start, size_t end)> fn)
-{
-	std::vector<std::thread> threads(numThreads);
-
-	int chunkSize = dataSize / numThreads;
-
-	for (int i = 0; i < numThreads; ++i)
-	{
-		int start = i * chunkSize;
-		int end = (i == numThreads - 1) ? dataSize : start + chunkSize;
-		threads[i] = std::thread(fn, start, end);
-	}
-
-	for (auto& thread : threads) {
-        thread.join();
-    }
-}
-
-
-
-auto orientation(const ds::Vec2 p, const ds::Vec2 q, const ds::Vec2 r) -> Orientation
-{
-	float value = (q.y - p.y) * (r.x - q.x) - (q.x - p.x) * (r.y - q.y);
-
-	return value >= 0.0f ? Orientation::ClockWise : Orientation::CounterClockWise;
-}
-
-auto hasIntersection(const Line l1, const Line l2) -> bool
-{
-	bool condition1 = orientation(l1.start, l1.end, l2.start) != orientation(l1.start, l1.end, l2.end);
-	bool condition2 = orientation(l2.start, l2.end, l1.start) != orientation(l2.start, l2.end, l1.end);
-
-	return condition1 and condition2;
-}
-
-auto getIntersectionPoint(const Line& l1, const Line& l2) -> std::optional<ds::Vec2>
-{
-	if (not hasIntersection(l1, l2))
-	{
-		return std::nullopt;
-	}
-
-	ds::Vec2 p = l1.start;
-	ds::Vec2 r = glm::normalize(l1.end - l1.start);
-
-	ds::Vec2 q = l2.start;
-	ds::Vec2 s = glm::normalize(l2.end - l2.start);
-
-	const auto cross2D = [](ds::Vec2 a, ds::Vec2 b) -> float
-		{
-			return a.x * b.y - a.y * b.x;
-		};
-
-	if (std::abs(cross2D(r, s)) > 0.001f)
-	{
-		float t = cross2D((q - p), s / cross2D(r, s));
-
-		return p + t * r;
-	}
-
-	return std::nullopt;
-}
-
 auto applyTransform2d(const glm::mat3 transf, const ds::Vec2 vec) -> ds::Vec2
 {
 	ds::Vec3 v3 = transf * ds::Vec3(vec, 1.0f);
@@ -123,356 +73,11 @@ auto renderViewport(rendering::Context& context, const camera::Camera& camera, c
 }
 
 
-auto sampleFromTexture(const media::Image& texture, const ds::Vec2 uv, const bool useFiltering) -> ds::ColorRGBA
-{
-	float uvx = (uv.x - (int64_t)uv.x);
-	float uvy = (uv.y - (int64_t)uv.y);
-
-	if (uvx < 0.0f)
-	{
-		uvx += 1.0f;
-	}
-	if (uvy < 0.0f)
-	{
-		uvy += 1.0f;
-	}
-
-	const float tx = texture.width * uvx;
-	const float ty = texture.height * uvy;
-
-	const size_t txi = static_cast<size_t>(tx);
-	const size_t tyi = static_cast<size_t>(ty);
-
-	auto getTexturePixelRepeated = [](const media::Image& texture, size_t x, size_t y, ds::ColorRGB& outColor)
-		{
-			outColor = texture.data[(y % texture.height) * texture.width + (x % texture.width)];
-		};
-
-	if (useFiltering == false)
-	{
-		ds::ColorRGB color{};
-		getTexturePixelRepeated(texture, txi, tyi, color);
-
-		return { color[0], color[1], color[2], 255 };
-	}
-
-	ds::ColorRGB pa{};
-	getTexturePixelRepeated(texture, txi, tyi, pa);
-	ds::ColorRGB pb{};
-	getTexturePixelRepeated(texture, txi + 1, tyi, pb);
-	ds::ColorRGB pc{};
-	getTexturePixelRepeated(texture, txi, tyi + 1, pc);
-	ds::ColorRGB pd{};
-	getTexturePixelRepeated(texture, txi + 1, tyi + 1, pd);
-
-	const int w1 = static_cast<int>(255.0f * (tx - (float)txi));
-	const int w2 = 255 - w1;
-
-	const std::array<int, 4> ab = {
-		(pb[0] * w1) + (pa[0] * w2),
-		(pb[1] * w1) + (pa[1] * w2),
-		(pb[2] * w1) + (pa[2] * w2)
-	};
-	const std::array<int, 4> cd = {
-		(pd[0] * w1) + (pc[0] * w2),
-		(pd[1] * w1) + (pc[1] * w2),
-		(pd[2] * w1) + (pc[2] * w2)
-	};
-
-	const int w3 = static_cast<int>(255.0f * (ty - (float)tyi));
-	const int w4 = 255 - w3;
-	const std::array<int, 4> abcd = {
-		((cd[0] * w3) + (ab[0] * w4)) / (255 * 255),
-		((cd[1] * w3) + (ab[1] * w4)) / (255 * 255),
-		((cd[2] * w3) + (ab[2] * w4)) / (255 * 255)
-	};
-
-	return ds::ColorRGBA(abcd[0], abcd[1], abcd[2], 255); // getTexturePixelRepeated(texture, txi, tyi);
-}
-
-size_t getMipmapLevel(float distance)
-{
-	if (distance < 10.0f)
-	{
-		return 0;
-	}
-	if (distance < 20.0f)
-	{
-		return 1;
-	}
-	if (distance < 40.0f)
-	{
-		return 2;
-	}
-	if (distance < 80.0f)
-	{
-		return 3;
-	}
-
-	return 0;
-}
-
-auto renderWalls(rendering::Context& context, const camera::Camera& camera, const std::vector<wall::Wall>& level, const std::vector<rendering::Texture>& textures)
-{
-	std::vector<ds::Vec3> colorBuffer(context.width, ds::Vec3(0.0f));
-	std::vector<float> zbuffer(context.width, 1.0f);
-	std::vector<float> uvBuffer(context.width, 0.0f);
-
-	const int numberOfRays = context.width;
-	const auto rayOrigin = camera.position;
-	const auto frontVector = camera.front;
-	const auto rightVector = ds::Vec2(frontVector.y, -frontVector.x);
-
-	const float projectionPlaneHeight = std::tanf(camera.fov / 2) * 2;
-	const float projectionPlaneWidth = projectionPlaneHeight * ((float)context.width / (float)context.height);
-	const float rayVectorOffset = projectionPlaneWidth / numberOfRays;
-
-	auto calculateWallZBuffer = [&](size_t start, size_t end)
-		{
-			for (size_t i = start; i < end; i++)
-			{
-				const float amountToOffset = (rayVectorOffset * (float)((int)i - (numberOfRays / 2)));
-				const auto rayDirection = glm::normalize(frontVector - rightVector * amountToOffset);
-
-				Line rayLine{ rayOrigin, rayOrigin + rayDirection * camera.farPlane };
-
-				for (const auto& wall : level)
-				{
-					std::optional hasIntersection = getIntersectionPoint(rayLine, wall.line);
-
-					if (hasIntersection.has_value())
-					{
-						auto intersectionPoint = *hasIntersection;
-
-						float eyeDistance = glm::distance(rayOrigin, intersectionPoint);
-
-						float normalizedCameraPlaneDistance = eyeDistance * glm::dot(frontVector, rayDirection) / camera.farPlane;
-
-						if (normalizedCameraPlaneDistance < zbuffer[i])
-						{
-							zbuffer[i] = normalizedCameraPlaneDistance;
-							colorBuffer[i] = wall.color;
-							uvBuffer[i] = glm::distance(intersectionPoint, wall.line.start);
-						}
-					}
-				}
-			}
-		};
-	//executeInParallel(12, numberOfRays, calculateWallZBuffer);
-	calculateWallZBuffer(0, numberOfRays);
-
-	auto render = [&](size_t start, size_t end)
-		{
-			for (size_t i = start; i < end; ++i)
-			{
-				float pixelDistance = zbuffer[i] * camera.farPlane;
-
-				if (pixelDistance < camera.farPlane)
-				{
-					float worlWallTop = 2.0f - camera.height;
-					float worlWallBottom = 0.0f - camera.height;
-					float viewWallTop = worlWallTop / pixelDistance;
-					float viewWallBottom = worlWallBottom / pixelDistance;
-					int screenWallTop = viewWallTop * (float)(context.height) / projectionPlaneHeight;
-					int screenWallBottom = viewWallBottom * (float)(context.height) / projectionPlaneHeight;
-
-					float pixelHorizontalPostion = zbuffer.size() - (i + 1);
-
-
-					size_t mipMapLevel = getMipmapLevel(pixelDistance);
-					const auto& texture = textures[0].mipmaps[mipMapLevel * (int)context.useMipmap];
-
-					for (int j = std::max(-(int)context.height / 2, screenWallBottom) + 1; j < std::min((int)context.height / 2, screenWallTop); j++)
-					{
-						const float uvY = camera.height + ((float)j * (projectionPlaneHeight / (float)context.height)) * pixelDistance;
-						const ds::Vec2 uv = ds::Vec2(uvBuffer[i], uvY);
-						//const ds::Vec2 uv = ds::Vec2(uvY, uvBuffer[i]);
-						const ds::Vec3 color = sampleFromTexture(texture, uv, context.useFiltering);
-
-						rendering::setSceenBufferPixel(context, static_cast<size_t>(pixelHorizontalPostion), context.height / 2 - j, ds::ColorRGBA(color, 1.0f));
-						rendering::setStencilBufferPixel(context, static_cast<size_t>(pixelHorizontalPostion), context.height / 2 - j, 1);
-						rendering::setDepthBufferPixel(context, static_cast<size_t>(pixelHorizontalPostion), context.height / 2 - j, zbuffer[i]);
-					}
-				}
-			}
-		};
-
-	executeInParallel(3, numberOfRays, render);
-
-}
-
-
-auto renderSprites(rendering::Context& context, const camera::Camera& camera, const std::vector<rendering::Sprite>& sprites)
-{
-	const int screenCenterX = context.width / 2;
-	const int screenCenterY = context.height / 2;
-	const float aspectRatio = (float)context.width / (float)context.height;
-
-	const ds::Vec2 cameraRight = ds::Vec2(camera.front.y, -camera.front.x);
-
-	for (const auto& sprite : sprites)
-	{
-		const float spriteCameraPlaneDistance = glm::dot(sprite.position - camera.position, camera.front);
-
-		if (spriteCameraPlaneDistance <= 0.0f)
-		{
-			continue;
-		}
-
-		const float spriteSize = sprite.size / (spriteCameraPlaneDistance * std::tan(camera.fov / 2.0f));
-
-		const float spriteWidth = spriteSize * context.height;
-		const float spriteHeight = spriteSize * context.height;
-
-		const ds::Vec2 fc = camera.position + camera.front * spriteCameraPlaneDistance;
-		const ds::Vec2 fcSpriteVector = sprite.position - fc;
-		const float distanceFc = glm::dot(fcSpriteVector, cameraRight);
-		const float distanceFcScreen = (distanceFc / spriteCameraPlaneDistance);
-
-		const int spriteScreenCenterX = distanceFcScreen * screenCenterX / (std::tan(camera.fov / 2) * aspectRatio) + screenCenterX;
-		const int spriteScreenCenterY = ((camera.height + sprite.height + 0.0f) / spriteCameraPlaneDistance) * screenCenterY / std::tan(camera.fov / 2) + screenCenterY;
-		const int spriteScreenLeft = spriteScreenCenterX - spriteWidth / 2;
-		const int spriteScreenRight = spriteScreenCenterX + spriteWidth / 2;
-		const int spriteScreenTop = spriteScreenCenterY - spriteHeight / 2;
-		const int spriteScreenBottom = spriteScreenCenterY + spriteHeight / 2;
-
-		for (int i = std::max(spriteScreenTop, 0); i < std::min(spriteScreenBottom, (int)context.height); i++)
-		{
-			for (int j = std::max(spriteScreenLeft, 0); j < std::min(spriteScreenRight, (int)context.width); j++)
-			{
-				if (context.depthBuffer[i * context.width + j] > spriteCameraPlaneDistance / camera.farPlane)
-				{
-					const auto uv = ds::Vec2((float)((j - spriteScreenLeft) / spriteWidth), -(float)((i - spriteScreenTop) / spriteHeight));
-					const auto color = sampleFromTexture(sprite.texture.mipmaps[0], uv, false);
-
-					if (color == ds::ColorRGBA(0, 255, 255, 255))
-					{
-						continue;
-					}
-
-					rendering::setSceenBufferPixel(context, j, i, color);
-					rendering::setDepthBufferPixel(context, j, i, spriteCameraPlaneDistance / camera.farPlane);
-				}
-			}
-		}
-	}
-}
-
-
-auto renderFloorAndCeiling(rendering::Context& context, const camera::Camera& camera, const std::vector<rendering::Texture>& textures)
-{
-	const int screenCenterX = context.width / 2;
-	const int screenCenterY = context.height / 2;
-
-	const float eyeHeight = camera.height;
-	const float projectionPlaneHeight = std::tanf(camera.fov / 2);
-	const float projectionPlaneWidth = projectionPlaneHeight * ((float)context.width / (float)context.height);
-	const size_t numberOfRays = context.height / 2;
-	const float rayOffset = projectionPlaneHeight / numberOfRays;
-
-	auto render = [&](size_t start, size_t end)
-		{
-			for (size_t i = start; i < end; ++i)
-			{
-				const auto ray = glm::normalize(ds::Vec2(1.0f, -(i * rayOffset))); // +x is forward and +y is up
-				const auto downVec = ds::Vec2(0.0f, -1.0f); // angle is measured from this vec
-				const float angle = std::acos(glm::dot(downVec, ray));
-				const float intersectionDistance = std::tanf(angle) * eyeHeight; // this is the distance of the intersection point between the ray and the floor
-
-
-				size_t mipMapLevel = getMipmapLevel(intersectionDistance);
-				const auto& floorTexture = textures[1].mipmaps[mipMapLevel * (int)context.useMipmap];
-
-				for (int j = 0; j < context.width; j++)
-				{
-					if (context.stencilBuffer[(i + screenCenterY) * context.width + j] == 1)
-					{
-						continue;
-					}
-
-					const auto right = ds::Vec2(camera.front.y, -camera.front.x);
-					const float uvFrontFactor = intersectionDistance;
-					const float uvRightFactor = (j - screenCenterX) * (projectionPlaneWidth / (float)(context.width / 2)) * intersectionDistance;
-					const auto uv = camera.position + (camera.front * uvFrontFactor) + (right * uvRightFactor);
-
-					const auto color = sampleFromTexture(floorTexture, uv, context.useFiltering);
-					//const auto color = ds::ColorRGBA(0.6f, 0.1f, 0.1f, 1.0f);
-
-					rendering::setSceenBufferPixel(context, j, i + screenCenterY, color);
-				}
-			}
-		};
-
-	executeInParallel(3, numberOfRays, render);
-}
-
-auto renderBackground(rendering::Context& context, const camera::Camera& camera, const std::vector<rendering::Texture>& textures)
-{
-	const int screenCenterX = context.width / 2;
-	const int screenCenterY = context.height / 2;
-
-	const float aspect = context.width / context.height;
-	constexpr float pi = glm::pi<float>();
-	constexpr float pi2 = 2 * pi;
-	const media::Image& skyTexture = textures[4].mipmaps[0];
-	const float textureAspect = (float)skyTexture.width / (float)skyTexture.height;
-
-	auto render = [&](size_t start, size_t end)
-		{
-			for (int i = start; i < end; i++)
-			{
-				for (int j = 0; j < screenCenterX * 2; j++)
-				{
-					if (context.depthBuffer[i * context.width + j] < 1.0f)
-					{
-						continue;
-					}
-
-					const auto frontVector = ds::Vec3(camera.front.x, 0.0f, camera.front.y);
-					const auto rightVector = ds::Vec3(camera.front.y, 0.0f, -camera.front.x);
-
-					const float dx = ((float)(j - screenCenterX) / (float)screenCenterX);
-					const float dy = ((float)((screenCenterY - i) / (float)screenCenterY));
-					auto rayDir = frontVector + rightVector * (dx * std::atan(camera.fov / 2.0f) * aspect);
-					rayDir.y = (dy * std::sin(camera.fov / 2.0f));
-
-					rayDir = glm::normalize(rayDir);
-					const float uvX = 0.5f + std::atan2(rayDir.z, rayDir.x) / pi2;
-					const float uvY = 0.5f + std::asin(rayDir.y) / pi;
-					const auto uv = ds::Vec2(uvX, uvY);
-					const auto color = sampleFromTexture(skyTexture, uv, true);
-
-					rendering::setSceenBufferPixel(context, j, i, color);
-				}
-			}
-		};
-
-	executeInParallel(6, screenCenterY, render);
-}
-
-auto renderMain(
-	rendering::Context& context,
-	const camera::Camera& camera,
-	const std::vector<wall::Wall>& level,
-	const std::vector<rendering::Texture>& textures,
-	const std::vector<rendering::Sprite>& sprites)
-{
-
-	rendering::clearContext(context);
-
-	renderWalls(context, camera, level, textures);
-	renderFloorAndCeiling(context, camera, textures);
-	renderSprites(context, camera, sprites);
-	renderBackground(context, camera, textures);
-
-	rendering::renderContext(context);
-}
 
 
+// Applies the keys held at the last poll to one simulation step of deltaTimeSecs
 auto processInput(SDL::EventHandler& eventHandler, camera::Camera& camera, rendering::Context& context, const float deltaTimeSecs)
 {
-	eventHandler.pollEvents();
-
 	const float movementSensivity = 7.0f * deltaTimeSecs;
 	float rotationSensivity = 1.0f * deltaTimeSecs;
 
@@ -539,6 +144,15 @@ auto processInput(SDL::EventHandler& eventHandler, camera::Camera& camera, rende
 		context.useMipmap = false;
 	}
 
+	if (eventHandler.getKeyState(SDL::KeyCode::KEY_C) == SDL::KeyState::Holding)
+	{
+		context.useTexturedCeiling = true;
+	}
+	if (eventHandler.getKeyState(SDL::KeyCode::KEY_V) == SDL::KeyState::Holding)
+	{
+		context.useTexturedCeiling = false;
+	}
+
 	if (eventHandler.getKeyState(SDL::KeyCode::KEY_B) == SDL::KeyState::Holding)
 	{
 		context.useFiltering = true;
@@ -547,42 +161,187 @@ auto processInput(SDL::EventHandler& eventHandler, camera::Camera& camera, rende
 	{
 		context.useFiltering = false;
 	}
+
+	if (eventHandler.getKeyState(SDL::KeyCode::KEY_O) == SDL::KeyState::Holding)
+	{
+		context.showProfilerOverlay = true;
+	}
+	if (eventHandler.getKeyState(SDL::KeyCode::KEY_I) == SDL::KeyState::Holding)
+	{
+		context.showProfilerOverlay = false;
+	}
+
+	if (eventHandler.getKeyState(SDL::KeyCode::KEY_L) == SDL::KeyState::Holding)
+	{
+		context.useLockedTexture = true;
+	}
+	if (eventHandler.getKeyState(SDL::KeyCode::KEY_K) == SDL::KeyState::Holding)
+	{
+		context.useLockedTexture = false;
+	}
 }
 
-auto loadTextures() -> std::vector<rendering::Texture>
+
+
+int main(int argc, char* argv[])
 {
-	std::string filenames[] = {
-		"assets/textures/brick.bmp",
-		"assets/textures/mud.bmp",
-		"assets/textures/coin.bmp",
-		"assets/textures/tree1.bmp",
-		"assets/textures/sky.bmp",
-	};
+	threading::ThreadPool threadPool;
+	profiler::Profiler frameProfiler;
+	scaling::ResolutionScaler resolutionScaler;
+
+	// --profile-csv <file> streams the times of every frame, --profile-json <file> writes
+	// their percentiles on exit and --record-path <file> saves the camera path for the
+	// benchmark to replay. --frame-budget <ms> sets the frame time the render resolution
+	// is scaled for, 0 keeps the window resolution. --level <file> picks the level, a JSON
+	// level or a cooked .rclevel file, --sectors <file> plays a sector map with the portal
+	// renderer instead. --views <count> splits the window between count cameras.
+	// --fog <start>,<end> fades everything between those distances into the fog, over the
+	// fog of a sector map.
+	std::string levelFilename = "assets/levels/demo.json";
+	std::string sectorsFilename;
+	std::string profileJsonFilename;
+	std::string recordPathFilename;
+	size_t viewCount = 1;
+	std::optional<std::pair<float, float>> fogDistances;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		const std::string option = argv[i];
+
+		if (option == "--profile-csv")
+		{
+			auto result = frameProfiler.openCsv(argv[i + 1]);
+
+			if (!result.has_value())
+			{
+				std::cout << result.error();
+				exit(1);
+			}
+		}
+		else if (option == "--profile-json")
+		{
+			profileJsonFilename = argv[i + 1];
+		}
+		else if (option == "--record-path")
+		{
+			recordPathFilename = argv[i + 1];
+		}
+		else if (option == "--level")
+		{
+			levelFilename = argv[i + 1];
+		}
+		else if (option == "--sectors")
+		{
+			sectorsFilename = argv[i + 1];
+		}
+		else if (option == "--views")
+		{
+			try
+			{
+				viewCount = std::stoul(argv[i + 1]);
+			}
+			catch (const std::exception&)
+			{
+				viewCount = 0;
+			}
+
+			if (viewCount == 0)
+			{
+				std::cout << std::format("Invalid view count '{}'", argv[i + 1]);
+				exit(1);
+			}
+		}
+		else if (option == "--fog")
+		{
+			float start = 0.0f;
+			float end = 0.0f;
+			char separator = 0;
+
+			std::istringstream stream(argv[i + 1]);
+			stream >> start >> separator >> end;
+
+			if (stream.fail() || separator != ',' || !(start >= 0.0f && end > start))
+			{
+				std::cout << std::format("Invalid fog '{}', expected <start>,<end>", argv[i + 1]);
+				exit(1);
+			}
+
+			fogDistances = std::make_pair(start, end);
+		}
+		else if (option == "--frame-budget")
+		{
+			try
+			{
+				resolutionScaler.frameBudget = std::stof(argv[i + 1]);
+			}
+			catch (const std::exception&)
+			{
+				std::cout << std::format("Invalid frame budget '{}'", argv[i + 1]);
+				exit(1);
+			}
+		}
+		else
+		{
+			std::cout << std::format("Unknown option '{}'", option);
+			exit(1);
+		}
+	}
 
-	std::vector<rendering::Texture> textures;
+	// Either a level streamed in chunks or a sector map, which is loaded whole
+	std::optional<level::Level> gameLevel;
+	std::optional<sector::SectorMap> sectorMap;
 
-	for (const auto& filename : filenames)
+	if (sectorsFilename.empty())
 	{
-		auto result = media::imageFromBitMapFile(filename);
+		auto loaded = level::loadLevel(levelFilename);
 
-		if (!result.has_value())
+		if (!loaded.has_value())
 		{
-			std::cout << result.error();
+			std::cout << loaded.error();
 			exit(1);
 		}
-		else
+
+		gameLevel = std::move(loaded.value());
+	}
+	else
+	{
+		auto loaded = sector::loadSectorMap(sectorsFilename);
+
+		if (!loaded.has_value())
 		{
-			textures.push_back(rendering::createTexture(std::move(result.value())));
+			std::cout << loaded.error();
+			exit(1);
 		}
+
+		sectorMap = std::move(loaded.value());
+		levelFilename = sectorsFilename;
 	}
 
-	return textures;
-}
+	const std::string& texturesFilename = sectorMap.has_value() ? sectorMap->texturesFilename : gameLevel->texturesFilename;
+	const std::vector<rendering::TextureId>& spriteTextures = sectorMap.has_value() ? sectorMap->spriteTextures : gameLevel->spriteTextures;
 
+	auto manifest = scene::loadTextureManifest(texturesFilename);
 
-int main(int argc, char* argv[])
-{
-	std::vector<rendering::Texture> textures = loadTextures();
+	if (!manifest.has_value())
+	{
+		std::cout << manifest.error();
+		exit(1);
+	}
+
+	// Decode the textures on the pool while the window is being created
+	const std::vector<std::string>& textureFilenames = manifest.value();
+	std::vector<std::expected<texture::Texture, std::string>> loadedTextures(textureFilenames.size());
+
+	auto loadTextures = [&](size_t start, size_t end)
+		{
+			for (size_t i = start; i < end; i++)
+			{
+				loadedTextures[i] = scene::loadTexture(textureFilenames[i]);
+			}
+		};
+
+	threading::JobHandle textureJob;
+	threadPool.dispatch(textureJob, textureFilenames.size(), 1, loadTextures);
 
 	SDL::initializeSDL();
 
@@ -595,94 +354,260 @@ int main(int argc, char* argv[])
 
 	rendering::Context mainContext(std::move(mainWindow), std::move(mainRenderer), screenWidth, screenHeight);
 
-	bool quit = false;
-	auto eventHandler = SDL::EventHandler();
+	if (sectorMap.has_value())
+	{
+		mainContext.fog = sectorMap->fog;
+	}
 
-	std::vector<wall::Wall> walls =
+	if (fogDistances.has_value())
 	{
-		wall::Wall(ds::Vec2(4.0f,  1.0f), ds::Vec2(2.0f,  1.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
-		wall::Wall(ds::Vec2(2.0f,  1.0f), ds::Vec2(2.0f,  3.0f), 1.0f, ds::Vec3(0.1f, 0.8f, 0.0f)),
-		wall::Wall(ds::Vec2(2.0f,  3.0f), ds::Vec2(-3.0f,  3.0f), 1.0f, ds::Vec3(0.1f, 0.0f, 0.8f)),
-		wall::Wall(ds::Vec2(-3.0f,  3.0f), ds::Vec2(-3.0f, -1.0f), 1.0f, ds::Vec3(0.8f, 0.0f, 0.1f)),
-		wall::Wall(ds::Vec2(-3.0f, -1.0f), ds::Vec2(0.0f, -1.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
-		wall::Wall(ds::Vec2(0.0f, -1.0f), ds::Vec2(0.0f, -2.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
-		wall::Wall(ds::Vec2(0.0f, -2.0f), ds::Vec2(-3.0f, -2.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
-		wall::Wall(ds::Vec2(-3.0f, -2.0f), ds::Vec2(-3.0f, -4.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
-		wall::Wall(ds::Vec2(-3.0f, -4.0f), ds::Vec2(1.0f, -4.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
-		wall::Wall(ds::Vec2(2.0f, -4.0f), ds::Vec2(3.0f, -4.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
-		wall::Wall(ds::Vec2(3.0f, -4.0f), ds::Vec2(3.0f, -2.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
-		wall::Wall(ds::Vec2(3.0f, -2.0f), ds::Vec2(2.0f, -2.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
-		wall::Wall(ds::Vec2(2.0f, -2.0f), ds::Vec2(2.0f,  0.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
-		wall::Wall(ds::Vec2(2.0f,  0.0f), ds::Vec2(4.0f,  0.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
-	};
+		mainContext.fog.fogStart = fogDistances->first;
+		mainContext.fog.fogEnd = fogDistances->second;
+	}
 
-	std::vector<rendering::Sprite> sprites;
+	threadPool.wait(textureJob);
 
-	std::vector<ds::Vec2> coinPositions =
-	{
-		{2.4f, 1.9f},
-		{0.1f, 1.5f},
-		{1.5f, 4.0f}
-	};
+	std::vector<texture::Texture> textures;
 
-	std::vector<ds::Vec2> treePositions =
+	for (auto& result : loadedTextures)
 	{
-		{100.0f, 10.0f},
-		{17.0f, 12.0f},
-		{-10.0f, -8.0f}
-	};
+		if (!result.has_value())
+		{
+			std::cout << result.error();
+			exit(1);
+		}
+
+		textures.push_back(std::move(result.value()));
+	}
+
+	bool quit = false;
+	auto eventHandler = SDL::EventHandler();
 
-	for (const auto& pos : coinPositions)
+	for (const rendering::TextureId id : spriteTextures)
 	{
-		auto coin = rendering::spriteFromTexture(textures[2]);
-		coin.size = 0.3f;
-		coin.position = pos;
-		coin.height = -0.2f;
+		if (id >= textures.size())
+		{
+			std::cout << std::format("Level '{}' uses texture {} but only {} are loaded", levelFilename, id, textures.size());
+			exit(1);
+		}
 
-		sprites.push_back(coin);
+		scene::prepareSpriteTexture(textures[id]);
 	}
 
-	for (const auto& pos : treePositions)
+	for (auto& texture : textures)
 	{
-		auto tree = rendering::spriteFromTexture(textures[3]);
+		texture::convertTexture(texture, mainContext.pixelLayout);
+	}
 
-		tree.position = pos;
-		tree.size = 2.0f;
-		tree.height = -2.0f;
+	const texture::TextureAtlas atlas = texture::packTextures(textures);
 
-		sprites.push_back(tree);
+	camera::Camera camera = camera::Camera();
+
+	// Split screen views share the pool, the textures and the level with each other
+	std::vector<rendering::View> views;
+
+	if (viewCount > 1)
+	{
+		for (const rendering::PixelRect& rect : rendering::splitScreen(screenWidth, screenHeight, viewCount))
+		{
+			views.emplace_back(rect);
+		}
 	}
 
-	camera::Camera camera = camera::Camera();
+	// Only the chunks around the camera are decoded, the first ones before the first frame
+	std::optional<level::ChunkStreamer> chunkStreamer;
+
+	if (gameLevel.has_value())
+	{
+		chunkStreamer.emplace(gameLevel.value(), threadPool, camera.farPlane);
+		chunkStreamer->loadNow(camera.position);
+	}
+
+	// The simulation advances in fixed steps, so movement and friction do not depend on the
+	// frame rate, and frames show the camera interpolated between the last two steps
+	constexpr float simulationStep = 1.0f / 60.0f;
+	constexpr float maxFrameTime = 0.25f;
+
+	camera::Camera previousCamera = camera;
+	float simulationTime = 0.0f;
+	bool hasRenderedFrame = false;
+	std::optional<rendering::FrameInputs> lastFrameInputs;
 
 	auto timeBefore = std::chrono::high_resolution_clock::now();
 	auto timeNow = std::chrono::high_resolution_clock::now();
 	float cumulativeTime = 0.0f;
 	int numFrames = 0;
+	int numIdleFrames = 0;
+	float idleTime = 0.0f;
+	size_t frameAllocations = 0;
+
+	scene::CameraPath recordedPath;
 
 	while (!eventHandler.shouldQuit())
 	{
 		timeNow = std::chrono::high_resolution_clock::now();
-		const float deltaTimeSec = std::chrono::duration_cast<std::chrono::milliseconds>(timeNow - timeBefore).count() / 1000.0f;
+		const float deltaTimeSec = std::chrono::duration<float>(timeNow - timeBefore).count();
 		timeBefore = timeNow;
 
-		processInput(eventHandler, camera, mainContext, deltaTimeSec);
+		eventHandler.pollEvents();
 
-		camera::updateCamera(camera);
+		simulationTime += std::min(deltaTimeSec, maxFrameTime);
 
-		renderMain(mainContext, camera, walls, textures, sprites);
+		while (simulationTime >= simulationStep)
+		{
+			previousCamera = camera;
+
+			processInput(eventHandler, camera, mainContext, simulationStep);
+
+			if (!recordPathFilename.empty())
+			{
+				recordedPath.push_back(scene::recordCameraStep(camera));
+			}
+
+			camera::updateCamera(camera);
+
+			simulationTime -= simulationStep;
+		}
+
+		const camera::Camera renderCamera = camera::interpolateCamera(previousCamera, camera, simulationTime / simulationStep);
+
+		// No frame is rendering here, so a finished load can be swapped in
+		if (chunkStreamer.has_value())
+		{
+			chunkStreamer->update(renderCamera.position);
+		}
 
-		numFrames += 1;
 		cumulativeTime += deltaTimeSec;
 
 		if (cumulativeTime > 1.0f)
 		{
-			std::cout << "Frame: " << numFrames / cumulativeTime << std::endl;
+			// Idle frames are left out of the frame rate and the profiler, they are counted
+			// on their own
+			const profiler::Percentiles frameTime = frameProfiler.framePercentiles();
+			const std::vector<float>& busyFractions = frameProfiler.busyFractions();
+
+			const float busy = std::accumulate(busyFractions.begin(), busyFractions.end(), 0.0f) / (float)std::max<size_t>(1, busyFractions.size());
+
+			std::cout << "Frame: " << numFrames / std::max(cumulativeTime - idleTime, 1e-6f);
+			std::cout << std::format(" p50/p95/p99: {:.2f}/{:.2f}/{:.2f} ms Busy: {:.0f}%", frameTime.p50, frameTime.p95, frameTime.p99, busy * 100.0f);
+			std::cout << std::format(" Resolution: {}x{}", mainContext.width, mainContext.height);
+			std::cout << std::format(" Idle: {} frames", numIdleFrames);
+
+			if constexpr (memory::isTrackingAllocations())
+			{
+				std::cout << " Allocations per frame: " << (float)frameAllocations / std::max(numFrames, 1);
+			}
+
+			std::cout << std::endl;
 			cumulativeTime = 0.0f;
+			idleTime = 0.0f;
 			numFrames = 0;
+			numIdleFrames = 0;
+			frameAllocations = 0;
+
+			frameProfiler.resetWindow(threadPool);
+		}
+
+		// An idle camera over the same scene would render the last frame again, it is
+		// presented once more instead and the loop sleeps until the next simulation step.
+		// The profiler overlay changes every frame, so it keeps the frames rendering, and
+		// so does a lowered resolution until the scaler has raised it back.
+		const rendering::FrameInputs frameInputs = rendering::frameInputs(mainContext, renderCamera, chunkStreamer.has_value() ? chunkStreamer->sceneVersion() : 0);
+
+		if (!mainContext.showProfilerOverlay && resolutionScaler.isFullResolution() && lastFrameInputs == frameInputs)
+		{
+			rendering::renderContext(mainContext);
+			std::this_thread::sleep_for(std::chrono::duration<float>(simulationStep));
+
+			numIdleFrames += 1;
+			idleTime += deltaTimeSec;
+			continue;
+		}
+
+		lastFrameInputs = frameInputs;
+
+		const size_t allocationsBefore = memory::allocationCount();
+
+		frameProfiler.beginFrame();
+
+		// The next frame renders on the pool while the last one is uploaded and presented
+		// here, SDL has to be called from the thread that created the renderer
+		rendering::acquireRenderTarget(mainContext);
+
+		auto renderView = [&](rendering::Context& context, const camera::Camera& viewCamera)
+			{
+				if (sectorMap.has_value())
+				{
+					rendering::renderSectorFrame(context, threadPool, frameProfiler, viewCamera, sectorMap.value(), textures, atlas);
+					return;
+				}
+
+				const scene::Scene& currentScene = chunkStreamer->currentScene();
+				rendering::renderFrame(context, threadPool, frameProfiler, viewCamera, currentScene.walls, currentScene.wallGrid, textures, atlas, currentScene.sprites);
+			};
+
+		auto renderJob = [&](size_t, size_t)
+			{
+				if (views.empty())
+				{
+					renderView(mainContext, renderCamera);
+					return;
+				}
+
+				// The first view is the player, the others look around from the same spot, so
+				// every view stays inside the streamed chunks
+				for (size_t i = 0; i < views.size(); i++)
+				{
+					views[i].camera = renderCamera;
+					views[i].camera.front = glm::rotate(renderCamera.front, 2.0f * std::numbers::pi_v<float> * (float)i / (float)views.size());
+				}
+
+				rendering::renderViews(mainContext, threadPool, frameProfiler, views, renderView);
+			};
+
+		threading::JobHandle frameJob;
+		threadPool.dispatch(frameJob, 1, 1, renderJob);
+
+		if (hasRenderedFrame)
+		{
+			profiler::ScopedTimer timer(frameProfiler, profiler::Pass::Present);
+			rendering::renderContext(mainContext);
+		}
+
+		threadPool.wait(frameJob);
+		rendering::releaseRenderTarget(mainContext);
+		hasRenderedFrame = true;
+
+		frameProfiler.endFrame(threadPool);
+
+		// Only between frames, the passes of the next one pick up the new resolution
+		resolutionScaler.update(frameProfiler, mainContext);
+
+		frameAllocations += memory::allocationCount() - allocationsBefore;
+		numFrames += 1;
+	}
+
+	if (!profileJsonFilename.empty())
+	{
+		auto result = frameProfiler.writeJson(profileJsonFilename);
+
+		if (!result.has_value())
+		{
+			std::cout << result.error();
+			exit(1);
+		}
+	}
+
+	if (!recordPathFilename.empty())
+	{
+		auto result = scene::writeCameraPath(recordedPath, recordPathFilename);
+
+		if (!result.has_value())
+		{
+			std::cout << result.error();
+			exit(1);
 		}
 	}
 
 	return 0;
 }
-
@@ -0,0 +1,435 @@
+#include <vector>
+#include <array>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <expected>
+#include <format>
+#include <numeric>
+#include <thread>
+#include <cstdint>
+
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/rotate_vector.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include "camera.hpp"
+#include "rendering.hpp"
+#include "threading.hpp"
+#include "simd.hpp"
+#include "texture.hpp"
+#include "profiler.hpp"
+#include "renderPasses.hpp"
+#include "scene.hpp"
+
+
+// Headless benchmark: replays a camera path through the same render passes as the game
+// without a window, for every combination of resolution and thread count. The camera
+// only moves through the path, so every run renders the same frames and the checksum of
+// the last one has to match between runs and builds.
+//
+//     RayCastingBench --frames 600 --resolution 800x600 --resolution 1920x1080 --threads 1 --threads 8
+//                     --path recorded.json --json results.json
+
+struct BenchOptions
+{
+	size_t numFrames = 600;
+	size_t warmupFrames = 16;
+
+	std::vector<std::pair<size_t, size_t>> resolutions;
+	std::vector<size_t> threadCounts;
+
+	std::string manifestFilename = "assets/textures.json";
+	std::string pathFilename;
+	std::string jsonFilename;
+
+	bool useMipmap = true;
+	bool useFiltering = true;
+	bool useTexturedCeiling = false;
+};
+
+
+struct BenchResult
+{
+	size_t width;
+	size_t height;
+	size_t threads;
+
+	size_t numFrames;
+	float totalTime;
+
+	profiler::Percentiles frameTime;
+	std::array<profiler::Percentiles, profiler::passCount> passTimes;
+	float busyFraction;
+
+	uint64_t checksum;
+};
+
+
+auto simdMode() -> const char*
+{
+#if defined(RAYCASTING_SSE2)
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}
+
+
+auto parseOptions(int argc, char* argv[]) -> std::expected<BenchOptions, std::string>
+{
+	BenchOptions options;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string option = argv[i];
+
+		if (option == "--no-mipmap")
+		{
+			options.useMipmap = false;
+			continue;
+		}
+		if (option == "--no-filtering")
+		{
+			options.useFiltering = false;
+			continue;
+		}
+		if (option == "--textured-ceiling")
+		{
+			options.useTexturedCeiling = true;
+			continue;
+		}
+
+		if (i + 1 >= argc)
+		{
+			return std::unexpected(std::format("Option '{}' needs a value", option));
+		}
+
+		const std::string value = argv[++i];
+
+		if (option == "--frames" || option == "--warmup" || option == "--threads")
+		{
+			size_t number = 0;
+
+			try
+			{
+				number = std::stoul(value);
+			}
+			catch (const std::exception&)
+			{
+				return std::unexpected(std::format("Invalid number '{}' for option '{}'", value, option));
+			}
+
+			if (option == "--frames")
+			{
+				options.numFrames = number;
+			}
+			else if (option == "--warmup")
+			{
+				options.warmupFrames = number;
+			}
+			else if (number == 0)
+			{
+				return std::unexpected(std::string("Thread count must not be 0"));
+			}
+			else
+			{
+				options.threadCounts.push_back(number);
+			}
+		}
+		else if (option == "--resolution")
+		{
+			size_t width = 0;
+			size_t height = 0;
+			char separator = 0;
+
+			std::istringstream stream(value);
+			stream >> width >> separator >> height;
+
+			if (stream.fail() || separator != 'x' || width < 2 || height < 2)
+			{
+				return std::unexpected(std::format("Invalid resolution '{}', expected <width>x<height>", value));
+			}
+
+			options.resolutions.emplace_back(width, height);
+		}
+		else if (option == "--manifest")
+		{
+			options.manifestFilename = value;
+		}
+		else if (option == "--path")
+		{
+			options.pathFilename = value;
+		}
+		else if (option == "--json")
+		{
+			options.jsonFilename = value;
+		}
+		else
+		{
+			return std::unexpected(std::format("Unknown option '{}'", option));
+		}
+	}
+
+	if (options.resolutions.empty())
+	{
+		options.resolutions.emplace_back(800, 600);
+	}
+
+	if (options.threadCounts.empty())
+	{
+		options.threadCounts.push_back(std::max<size_t>(1, std::thread::hardware_concurrency()));
+	}
+
+	return options;
+}
+
+
+// FNV-1a over the pixels of the last presented frame
+auto checksumFrame(const rendering::Context& context) -> uint64_t
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	for (const uint32_t pixel : context.presentBuffer)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			hash ^= (pixel >> (8 * i)) & 0xFF;
+			hash *= 0x100000001b3ull;
+		}
+	}
+
+	return hash;
+}
+
+
+auto runBenchmark(
+	const BenchOptions& options,
+	const size_t width,
+	const size_t height,
+	const size_t threads,
+	const scene::Scene& demoScene,
+	const std::vector<texture::Texture>& textures,
+	const texture::TextureAtlas& atlas,
+	const scene::CameraPath& path) -> BenchResult
+{
+	threading::ThreadPool pool(threads);
+	profiler::Profiler frameProfiler;
+
+	rendering::Context context(width, height);
+	context.useMipmap = options.useMipmap;
+	context.useFiltering = options.useFiltering;
+	context.useTexturedCeiling = options.useTexturedCeiling;
+
+	camera::Camera camera = camera::Camera();
+
+	// Warm up the caches, the tables and the arena on the first frame of the path
+	for (size_t i = 0; i < options.warmupFrames; i++)
+	{
+		rendering::renderMain(context, pool, frameProfiler, camera, demoScene.walls, demoScene.wallGrid, textures, atlas, demoScene.sprites);
+	}
+
+	frameProfiler = profiler::Profiler();
+	frameProfiler.resetWindow(pool);
+
+	const auto start = profiler::Clock::now();
+
+	for (size_t i = 0; i < options.numFrames; i++)
+	{
+		scene::applyCameraStep(camera, path[i % path.size()]);
+		camera::updateCamera(camera);
+
+		frameProfiler.beginFrame();
+		rendering::renderMain(context, pool, frameProfiler, camera, demoScene.walls, demoScene.wallGrid, textures, atlas, demoScene.sprites);
+		frameProfiler.endFrame(pool);
+	}
+
+	const float totalTime = std::chrono::duration<float>(profiler::Clock::now() - start).count();
+
+	BenchResult result{ width, height, threads, options.numFrames, totalTime };
+
+	result.frameTime = frameProfiler.framePercentiles();
+
+	for (size_t pass = 0; pass < profiler::passCount; pass++)
+	{
+		result.passTimes[pass] = frameProfiler.passPercentiles((profiler::Pass)pass);
+	}
+
+	const std::vector<float>& busyFractions = frameProfiler.busyFractions();
+	result.busyFraction = std::accumulate(busyFractions.begin(), busyFractions.end(), 0.0f) / (float)std::max<size_t>(1, busyFractions.size());
+
+	result.checksum = checksumFrame(context);
+
+	return result;
+}
+
+
+auto megapixelsPerSecond(const BenchResult& result) -> float
+{
+	if (!(result.totalTime > 0.0f))
+	{
+		return 0.0f;
+	}
+
+	return (float)(result.width * result.height * result.numFrames) / result.totalTime / 1.0e6f;
+}
+
+
+// Percentiles are taken over the last Profiler::historySize frames of each run
+auto writeResults(const std::vector<BenchResult>& results, const BenchOptions& options, const std::string& filename) -> std::expected<void, std::string>
+{
+	const auto toJson = [](const profiler::Percentiles& p)
+		{
+			return nlohmann::json{ { "p50", p.p50 }, { "p95", p.p95 }, { "p99", p.p99 } };
+		};
+
+	nlohmann::json runs = nlohmann::json::array();
+
+	for (const auto& result : results)
+	{
+		nlohmann::json run;
+		run["width"] = result.width;
+		run["height"] = result.height;
+		run["threads"] = result.threads;
+		run["frames"] = result.numFrames;
+		run["totalTime"] = result.totalTime;
+		run["megapixelsPerSecond"] = megapixelsPerSecond(result);
+		run["busyFraction"] = result.busyFraction;
+		run["frameTime"] = toJson(result.frameTime);
+		run["checksum"] = std::format("{:016x}", result.checksum);
+
+		for (size_t pass = 0; pass < profiler::passCount; pass++)
+		{
+			run["passes"][profiler::passNames[pass]] = toJson(result.passTimes[pass]);
+		}
+
+		runs.push_back(run);
+	}
+
+	nlohmann::json report;
+	report["simd"] = simdMode();
+	report["path"] = options.pathFilename.empty() ? "orbit" : options.pathFilename;
+	report["useMipmap"] = options.useMipmap;
+	report["useFiltering"] = options.useFiltering;
+	report["useTexturedCeiling"] = options.useTexturedCeiling;
+	report["runs"] = runs;
+
+	std::ofstream fileStream(filename, std::ios::trunc);
+
+	if (!fileStream.is_open())
+	{
+		return std::unexpected(std::format("Failed to create file '{}'", filename));
+	}
+
+	fileStream << report.dump(4) << '\n';
+
+	return {};
+}
+
+
+int main(int argc, char* argv[])
+{
+	auto parsed = parseOptions(argc, argv);
+
+	if (!parsed.has_value())
+	{
+		std::cout << parsed.error() << "\n";
+		return 1;
+	}
+
+	const BenchOptions& options = parsed.value();
+
+	auto manifest = scene::loadTextureManifest(options.manifestFilename);
+
+	if (!manifest.has_value())
+	{
+		std::cout << manifest.error() << "\n";
+		return 1;
+	}
+
+	std::vector<texture::Texture> textures;
+
+	for (const auto& filename : manifest.value())
+	{
+		auto result = scene::loadTexture(filename);
+
+		if (!result.has_value())
+		{
+			std::cout << result.error() << "\n";
+			return 1;
+		}
+
+		textures.push_back(std::move(result.value()));
+	}
+
+	const scene::Scene demoScene = scene::createDemoScene();
+	scene::prepareSpriteTextures(demoScene, textures);
+
+	// The bench contexts keep the default RGBA8888 layout, textures cooked for another
+	// layout are converted once here
+	for (auto& texture : textures)
+	{
+		texture::convertTexture(texture, ds::rgbaLayout);
+	}
+
+	const texture::TextureAtlas atlas = texture::packTextures(textures);
+
+	scene::CameraPath path;
+
+	if (options.pathFilename.empty())
+	{
+		path = scene::orbitCameraPath(std::max<size_t>(1, options.numFrames));
+	}
+	else
+	{
+		auto loaded = scene::loadCameraPath(options.pathFilename);
+
+		if (!loaded.has_value() || loaded.value().empty())
+		{
+			std::cout << (loaded.has_value() ? std::format("Camera path '{}' is empty", options.pathFilename) : loaded.error()) << "\n";
+			return 1;
+		}
+
+		path = std::move(loaded.value());
+	}
+
+	std::cout << std::format("SIMD: {} Frames: {} Warmup: {}\n", simdMode(), options.numFrames, options.warmupFrames);
+
+	std::vector<BenchResult> results;
+
+	for (const auto& [width, height] : options.resolutions)
+	{
+		for (const size_t threads : options.threadCounts)
+		{
+			const BenchResult result = runBenchmark(options, width, height, threads, demoScene, textures, atlas, path);
+
+			std::cout << std::format("{}x{} threads: {} frame p50/p95/p99: {:.2f}/{:.2f}/{:.2f} ms {:.1f} Mpixels/s busy: {:.0f}% checksum: {:016x}\n",
+				result.width, result.height, result.threads,
+				result.frameTime.p50, result.frameTime.p95, result.frameTime.p99,
+				megapixelsPerSecond(result), result.busyFraction * 100.0f, result.checksum);
+
+			for (size_t pass = 0; pass < profiler::passCount; pass++)
+			{
+				std::cout << std::format("    {:<16} p50: {:.3f} ms p99: {:.3f} ms\n", profiler::passNames[pass], result.passTimes[pass].p50, result.passTimes[pass].p99);
+			}
+
+			results.push_back(result);
+		}
+	}
+
+	if (!options.jsonFilename.empty())
+	{
+		auto written = writeResults(results, options, options.jsonFilename);
+
+		if (!written.has_value())
+		{
+			std::cout << written.error() << "\n";
+			return 1;
+		}
+	}
+
+	return 0;
+}
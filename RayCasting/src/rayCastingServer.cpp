@@ -0,0 +1,344 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <optional>
+#include <expected>
+#include <format>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/rotate_vector.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include "camera.hpp"
+#include "rendering.hpp"
+#include "threading.hpp"
+#include "texture.hpp"
+#include "profiler.hpp"
+#include "renderPasses.hpp"
+#include "scene.hpp"
+#include "level.hpp"
+#include "sector.hpp"
+
+
+// Headless renderer for previews and remote play on machines without a display. Renders
+// a camera path with several independent contexts on one pool and streams the frames in
+// path order as raw RGBA8, ready for an encoder:
+//
+//     RayCastingServer --level assets/levels/demo.json --path recorded.json --resolution 640x360
+//                      --contexts 4 --output frames.rgba
+//     ffmpeg -f rawvideo -pix_fmt rgba -s 640x360 -i frames.rgba preview.mp4
+
+struct ServerOptions
+{
+	size_t numFrames = 240;
+	size_t width = 320;
+	size_t height = 240;
+	size_t numContexts = 4;
+	size_t numThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+	std::string levelFilename = "assets/levels/demo.json";
+	std::string sectorsFilename;
+	std::string pathFilename;
+	std::string outputFilename;
+};
+
+
+// Cameras rendered per call of renderBatch. The chunks around the first camera of a batch
+// are streamed in before it, so the cameras of a batch should stay close to each other.
+constexpr size_t batchSize = 64;
+
+
+auto parseOptions(int argc, char* argv[]) -> std::expected<ServerOptions, std::string>
+{
+	ServerOptions options;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string option = argv[i];
+
+		if (i + 1 >= argc)
+		{
+			return std::unexpected(std::format("Option '{}' needs a value", option));
+		}
+
+		const std::string value = argv[++i];
+
+		if (option == "--frames" || option == "--contexts" || option == "--threads")
+		{
+			size_t number = 0;
+
+			try
+			{
+				number = std::stoul(value);
+			}
+			catch (const std::exception&)
+			{
+				return std::unexpected(std::format("Invalid number '{}' for option '{}'", value, option));
+			}
+
+			if (number == 0)
+			{
+				return std::unexpected(std::format("Option '{}' must not be 0", option));
+			}
+
+			if (option == "--frames")
+			{
+				options.numFrames = number;
+			}
+			else if (option == "--contexts")
+			{
+				options.numContexts = number;
+			}
+			else
+			{
+				options.numThreads = number;
+			}
+		}
+		else if (option == "--resolution")
+		{
+			char separator = 0;
+
+			std::istringstream stream(value);
+			stream >> options.width >> separator >> options.height;
+
+			if (stream.fail() || separator != 'x' || options.width < 2 || options.height < 2)
+			{
+				return std::unexpected(std::format("Invalid resolution '{}', expected <width>x<height>", value));
+			}
+		}
+		else if (option == "--level")
+		{
+			options.levelFilename = value;
+		}
+		else if (option == "--sectors")
+		{
+			options.sectorsFilename = value;
+		}
+		else if (option == "--path")
+		{
+			options.pathFilename = value;
+		}
+		else if (option == "--output")
+		{
+			options.outputFilename = value;
+		}
+		else
+		{
+			return std::unexpected(std::format("Unknown option '{}'", option));
+		}
+	}
+
+	if (options.outputFilename.empty())
+	{
+		return std::unexpected(std::string("Missing option '--output <file>'"));
+	}
+
+	return options;
+}
+
+
+int main(int argc, char* argv[])
+{
+	auto parsed = parseOptions(argc, argv);
+
+	if (!parsed.has_value())
+	{
+		std::cout << parsed.error() << "\n";
+		return 1;
+	}
+
+	const ServerOptions& options = parsed.value();
+
+	threading::ThreadPool pool(options.numThreads);
+	profiler::Profiler frameProfiler;
+
+	// Either a level streamed in chunks or a sector map, which is loaded whole
+	std::optional<level::Level> gameLevel;
+	std::optional<sector::SectorMap> sectorMap;
+
+	if (options.sectorsFilename.empty())
+	{
+		auto loaded = level::loadLevel(options.levelFilename);
+
+		if (!loaded.has_value())
+		{
+			std::cout << loaded.error() << "\n";
+			return 1;
+		}
+
+		gameLevel = std::move(loaded.value());
+	}
+	else
+	{
+		auto loaded = sector::loadSectorMap(options.sectorsFilename);
+
+		if (!loaded.has_value())
+		{
+			std::cout << loaded.error() << "\n";
+			return 1;
+		}
+
+		sectorMap = std::move(loaded.value());
+	}
+
+	const std::string& texturesFilename = sectorMap.has_value() ? sectorMap->texturesFilename : gameLevel->texturesFilename;
+	const std::vector<rendering::TextureId>& spriteTextures = sectorMap.has_value() ? sectorMap->spriteTextures : gameLevel->spriteTextures;
+
+	auto manifest = scene::loadTextureManifest(texturesFilename);
+
+	if (!manifest.has_value())
+	{
+		std::cout << manifest.error() << "\n";
+		return 1;
+	}
+
+	std::vector<texture::Texture> textures;
+
+	for (const auto& filename : manifest.value())
+	{
+		auto result = scene::loadTexture(filename);
+
+		if (!result.has_value())
+		{
+			std::cout << result.error() << "\n";
+			return 1;
+		}
+
+		textures.push_back(std::move(result.value()));
+	}
+
+	for (const rendering::TextureId id : spriteTextures)
+	{
+		if (id >= textures.size())
+		{
+			std::cout << std::format("Level uses texture {} but only {} are loaded\n", id, textures.size());
+			return 1;
+		}
+
+		scene::prepareSpriteTexture(textures[id]);
+	}
+
+	// Packed so the bytes of every pixel are R, G, B, A in memory on little endian machines
+	const ds::PixelLayout outputLayout = ds::abgrLayout;
+
+	for (auto& texture : textures)
+	{
+		texture::convertTexture(texture, outputLayout);
+	}
+
+	const texture::TextureAtlas atlas = texture::packTextures(textures);
+
+	// The camera path is replayed up front, every frame only depends on its own camera
+	scene::CameraPath path;
+
+	if (options.pathFilename.empty())
+	{
+		path = scene::orbitCameraPath(options.numFrames);
+	}
+	else
+	{
+		auto loaded = scene::loadCameraPath(options.pathFilename);
+
+		if (!loaded.has_value() || loaded.value().empty())
+		{
+			std::cout << (loaded.has_value() ? std::format("Camera path '{}' is empty", options.pathFilename) : loaded.error()) << "\n";
+			return 1;
+		}
+
+		path = std::move(loaded.value());
+	}
+
+	std::vector<camera::Camera> cameras;
+	camera::Camera camera = camera::Camera();
+
+	for (const auto& step : path)
+	{
+		scene::applyCameraStep(camera, step);
+		camera::updateCamera(camera);
+		cameras.push_back(camera);
+	}
+
+	std::vector<rendering::Context> contexts;
+
+	for (size_t i = 0; i < options.numContexts; i++)
+	{
+		rendering::Context& context = contexts.emplace_back(options.width, options.height);
+		context.pixelLayout = outputLayout;
+
+		if (sectorMap.has_value())
+		{
+			context.fog = sectorMap->fog;
+		}
+	}
+
+	std::optional<level::ChunkStreamer> chunkStreamer;
+
+	if (gameLevel.has_value())
+	{
+		chunkStreamer.emplace(gameLevel.value(), pool, cameras.front().farPlane);
+	}
+
+	std::ofstream output(options.outputFilename, std::ios::binary | std::ios::trunc);
+
+	if (!output.is_open())
+	{
+		std::cout << std::format("Failed to create file '{}'\n", options.outputFilename);
+		return 1;
+	}
+
+	auto renderView = [&](rendering::Context& context, const camera::Camera& viewCamera)
+		{
+			if (sectorMap.has_value())
+			{
+				rendering::renderSectorFrame(context, pool, frameProfiler, viewCamera, sectorMap.value(), textures, atlas);
+				return;
+			}
+
+			const scene::Scene& currentScene = chunkStreamer->currentScene();
+			rendering::renderFrame(context, pool, frameProfiler, viewCamera, currentScene.walls, currentScene.wallGrid, textures, atlas, currentScene.sprites);
+		};
+
+	auto writeFrame = [&](const rendering::BatchFrame& frame)
+		{
+			for (size_t y = 0; y < frame.height; y++)
+			{
+				output.write((const char*)(frame.pixels + y * frame.pitch), (std::streamsize)(frame.width * sizeof(uint32_t)));
+			}
+		};
+
+	const auto start = profiler::Clock::now();
+
+	std::vector<camera::Camera> batch;
+
+	for (size_t first = 0; first < cameras.size(); first += batchSize)
+	{
+		batch.assign(cameras.begin() + first, cameras.begin() + std::min(first + batchSize, cameras.size()));
+
+		if (chunkStreamer.has_value())
+		{
+			chunkStreamer->loadNow(batch.front().position);
+		}
+
+		rendering::renderBatch(contexts, pool, batch, renderView, writeFrame);
+	}
+
+	const float totalTime = std::chrono::duration<float>(profiler::Clock::now() - start).count();
+
+	if (!output.good())
+	{
+		std::cout << std::format("Failed to write file '{}'\n", options.outputFilename);
+		return 1;
+	}
+
+	std::cout << std::format("{} frames of {}x{} in {:.2f} s, {:.1f} frames/s\n", cameras.size(), options.width, options.height, totalTime, (float)cameras.size() / std::max(totalTime, 1e-6f));
+
+	return 0;
+}
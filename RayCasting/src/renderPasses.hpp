@@ -0,0 +1,1273 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <span>
+#include <optional>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glm/gtc/constants.hpp>
+
+#include "camera.hpp"
+#include "wall.hpp"
+#include "rendering.hpp"
+#include "threading.hpp"
+#include "spatial.hpp"
+#include "simd.hpp"
+#include "memory.hpp"
+#include "sampler.hpp"
+#include "texture.hpp"
+#include "profiler.hpp"
+#include "sector.hpp"
+
+
+// Render passes of a frame, shared by the game and the benchmark
+namespace rendering
+{
+	// Tile sizes used to split the render passes on the thread pool. Small enough
+	// that columns close to walls and columns showing sky balance out between threads.
+	constexpr size_t columnTileSize = 16;
+	constexpr size_t rowTileSize = 4;
+	constexpr size_t resolveTileSize = 16;
+	constexpr size_t spriteTileSize = 64;
+
+
+	// Rebuilds the column ray tables when the field of view or the resolution changed. The
+	// rays are spread evenly over the projection plane, turning only changes the basis they
+	// are expressed in.
+	auto updateRayTables(rendering::RayTables& tables, const size_t width, const size_t height, const float aspectRatio, const camera::Camera& camera)
+	{
+		if (tables.fov == camera.fov && tables.width == width && tables.height == height)
+		{
+			return;
+		}
+
+		tables.fov = camera.fov;
+		tables.width = width;
+		tables.height = height;
+
+		const int numberOfRays = width;
+		const float projectionPlaneHeight = std::tanf(camera.fov / 2) * 2;
+		const float projectionPlaneWidth = projectionPlaneHeight * aspectRatio;
+		const float rayVectorOffset = projectionPlaneWidth / numberOfRays;
+
+		tables.projectionPlaneHeight = projectionPlaneHeight;
+		tables.forward.resize(width);
+		tables.right.resize(width);
+
+		for (size_t i = 0; i < width; i++)
+		{
+			const float amountToOffset = (rayVectorOffset * (float)((int)i - (numberOfRays / 2)));
+			const float inverseLength = 1.0f / std::sqrt(1.0f + amountToOffset * amountToOffset);
+
+			tables.forward[i] = inverseLength;
+			tables.right[i] = -amountToOffset * inverseLength;
+		}
+	}
+
+
+	auto renderWalls(rendering::Context& context, threading::ThreadPool& pool, const camera::Camera& camera, const std::vector<wall::Wall>& level, const spatial::WallGrid& grid, const texture::TextureAtlas& atlas)
+	{
+		// One record per column, tiles of columnTileSize records start on a cache line. The
+		// ray pass resolves the material of the wall hit, so filling a column only reads the
+		// atlas tables.
+		struct alignas(16) WallColumn
+		{
+			float depth;
+			float u;
+			uint32_t wallIndex;
+			uint32_t material;
+		};
+
+		static_assert((columnTileSize * sizeof(WallColumn)) % simd::cacheLineSize == 0);
+
+		const std::span<WallColumn> wallColumns = context.frameArena.allocate<WallColumn>(context.width, simd::cacheLineSize);
+		std::fill(wallColumns.begin(), wallColumns.end(), WallColumn{ 1.0f, 0.0f, 0, 0 });
+
+		const int numberOfRays = context.width;
+		const auto rayOrigin = camera.position;
+		const auto frontVector = camera.front;
+		const auto rightVector = ds::Vec2(frontVector.y, -frontVector.x);
+
+		const rendering::RayTables& rays = context.rayTables;
+		updateRayTables(context.rayTables, context.width, context.height, rendering::aspectRatio(context), camera);
+
+		const float projectionPlaneHeight = rays.projectionPlaneHeight;
+
+		auto calculateWallZBuffer = [&](size_t start, size_t end)
+			{
+				for (size_t i = start; i < end; i++)
+				{
+					const auto rayDirection = frontVector * rays.forward[i] + rightVector * rays.right[i];
+
+					const std::optional hit = spatial::castRay(grid, rayOrigin, rayDirection, camera.farPlane);
+
+					if (hit.has_value())
+					{
+						const float normalizedCameraPlaneDistance = hit->distance * rays.forward[i] / camera.farPlane;
+
+						// Materials missing from the atlas fall back to the first texture
+						const uint32_t material = level[hit->wallIndex].material;
+
+						wallColumns[i] = WallColumn{ std::min(normalizedCameraPlaneDistance, 1.0f), hit->wallOffset, hit->wallIndex, material < atlas.materials.size() ? material : 0 };
+					}
+				}
+			};
+
+		pool.parallelFor(numberOfRays, columnTileSize, calculateWallZBuffer);
+
+		auto render = [&](size_t start, size_t end)
+			{
+				for (size_t i = start; i < end; ++i)
+				{
+					float pixelDistance = wallColumns[i].depth * camera.farPlane;
+
+					float pixelHorizontalPostion = wallColumns.size() - (i + 1);
+					const size_t x = static_cast<size_t>(pixelHorizontalPostion);
+
+					context.wallSpans[x] = rendering::WallSpan{ 0, 0, 1.0f };
+
+					if (pixelDistance < camera.farPlane)
+					{
+						float worlWallTop = 2.0f - camera.height;
+						float worlWallBottom = 0.0f - camera.height;
+						float viewWallTop = worlWallTop / pixelDistance;
+						float viewWallBottom = worlWallBottom / pixelDistance;
+						int screenWallTop = viewWallTop * (float)(context.height) / projectionPlaneHeight;
+						int screenWallBottom = viewWallBottom * (float)(context.height) / projectionPlaneHeight;
+
+						// Pixel footprint on the wall, vertically from the projection and horizontally
+						// from how fast the wall offset changes between neighbour columns
+						const float verticalFootprint = pixelDistance * projectionPlaneHeight / (float)context.height;
+						float horizontalFootprint = 0.0f;
+
+						if (i + 1 < wallColumns.size() && wallColumns[i + 1].wallIndex == wallColumns[i].wallIndex && wallColumns[i + 1].depth < 1.0f)
+						{
+							horizontalFootprint = std::abs(wallColumns[i + 1].u - wallColumns[i].u);
+						}
+
+						const texture::TextureAtlas::Material& material = atlas.materials[wallColumns[i].material];
+						const float texelsPerPixel = std::max(verticalFootprint, horizontalFootprint) * material.width;
+						size_t mipMapLevel = texture::selectMipmapLevel(material.levelCount, texelsPerPixel);
+						const auto& texture = atlas.levels[material.firstLevel + mipMapLevel * (int)context.useMipmap];
+
+						const int firstRow = std::max(-(int)context.height / 2, screenWallBottom) + 1;
+						const int lastRow = std::min((int)context.height / 2, screenWallTop);
+
+						if (firstRow >= lastRow)
+						{
+							continue;
+						}
+
+						// Texture V is linear in the screen row, the column is sampled as one span going up
+						const float uvStepY = (projectionPlaneHeight / (float)context.height) * pixelDistance;
+						const ds::Vec2 uv = ds::Vec2(wallColumns[i].u, camera.height + (float)firstRow * uvStepY);
+						//const ds::Vec2 uv = ds::Vec2(uvY, wallColumns[i].u);
+
+						const int spanTop = (int)context.height / 2 - lastRow + 1;
+						const int spanBottom = (int)context.height / 2 - firstRow + 1;
+
+						uint32_t* p_output = &context.wallBuffer[x * context.height + (size_t)(spanBottom - 1)];
+						sampler::sampleSpan(texture, uv, ds::Vec2(0.0f, uvStepY), lastRow - firstRow, p_output, -1, context.useFiltering, rendering::shadeAt(context, pixelDistance, 1.0f));
+
+						context.wallSpans[x] = rendering::WallSpan{ spanTop, spanBottom, wallColumns[i].depth };
+					}
+				}
+			};
+
+		pool.parallelFor(numberOfRays, columnTileSize, render);
+	}
+
+
+	// Copies the wall spans from the column major wall buffer to the screen. Each task owns a
+	// band of resolveTileSize rows, so a column is read as one short contiguous run and the
+	// rows are written left to right.
+	auto resolveWalls(rendering::Context& context, threading::ThreadPool& pool)
+	{
+		const size_t height = context.height;
+		const size_t width = context.width;
+		const size_t pitch = context.targetPitch;
+
+		auto resolve = [&](size_t start, size_t end)
+			{
+				for (size_t x0 = 0; x0 < width; x0 += resolveTileSize)
+				{
+					const size_t x1 = std::min(x0 + resolveTileSize, width);
+
+					for (size_t x = x0; x < x1; x++)
+					{
+						const rendering::WallSpan& span = context.wallSpans[x];
+						const size_t top = std::max((size_t)std::max(span.top, 0), start);
+						const size_t bottom = std::min((size_t)std::max(span.bottom, 0), end);
+
+						const uint32_t* p_input = &context.wallBuffer[x * height];
+
+						for (size_t y = top; y < bottom; y++)
+						{
+							context.targetPixels[y * pitch + x] = p_input[y];
+						}
+					}
+				}
+			};
+
+		pool.parallelFor(height, resolveTileSize, resolve);
+	}
+
+
+	// Sprites are culled and projected first, sorted front to back and binned into screen
+	// tiles. Every tile is then drawn by one task, so depth buffer writes never overlap
+	// between threads and nearer sprites are drawn first.
+	auto renderSprites(rendering::Context& context, threading::ThreadPool& pool, const camera::Camera& camera, const std::vector<rendering::Sprite>& sprites, const std::vector<texture::Texture>& textures)
+	{
+		struct ProjectedSprite
+		{
+			float depth;
+			uint32_t index;
+
+			int screenLeft;
+			int screenTop;
+			float screenWidth;
+			float screenHeight;
+
+			rendering::PixelRect bounds;
+			sampler::Shade shade;
+		};
+
+		const int screenCenterX = context.width / 2;
+		const int screenCenterY = context.height / 2;
+		const float aspectRatio = rendering::aspectRatio(context);
+		const float tanHalfFov = std::tan(camera.fov / 2.0f);
+
+		// Columns per unit of screen height, equal to the height when pixels are square
+		const float columnsPerHeight = (float)(context.width * context.outputHeight) / (float)context.outputWidth;
+
+		const ds::Vec2 cameraRight = ds::Vec2(camera.front.y, -camera.front.x);
+
+		const std::span<ProjectedSprite> projected = context.frameArena.allocate<ProjectedSprite>(sprites.size());
+		size_t numVisible = 0;
+
+		for (size_t s = 0; s < sprites.size(); s++)
+		{
+			const auto& sprite = sprites[s];
+
+			const float spriteCameraPlaneDistance = glm::dot(sprite.position - camera.position, camera.front);
+
+			// Behind the camera, or past the far plane where nothing is drawn over the sky
+			if (spriteCameraPlaneDistance <= 0.0f || spriteCameraPlaneDistance >= camera.farPlane)
+			{
+				continue;
+			}
+
+			const float spriteSize = sprite.size / (spriteCameraPlaneDistance * tanHalfFov);
+
+			const float spriteWidth = spriteSize * columnsPerHeight;
+			const float spriteHeight = spriteSize * context.height;
+
+			const ds::Vec2 fc = camera.position + camera.front * spriteCameraPlaneDistance;
+			const ds::Vec2 fcSpriteVector = sprite.position - fc;
+			const float distanceFc = glm::dot(fcSpriteVector, cameraRight);
+			const float distanceFcScreen = (distanceFc / spriteCameraPlaneDistance);
+
+			const int spriteScreenCenterX = distanceFcScreen * screenCenterX / (tanHalfFov * aspectRatio) + screenCenterX;
+			const int spriteScreenCenterY = ((camera.height + sprite.height + 0.0f) / spriteCameraPlaneDistance) * screenCenterY / tanHalfFov + screenCenterY;
+			const int spriteScreenLeft = spriteScreenCenterX - spriteWidth / 2;
+			const int spriteScreenRight = spriteScreenCenterX + spriteWidth / 2;
+			const int spriteScreenTop = spriteScreenCenterY - spriteHeight / 2;
+			const int spriteScreenBottom = spriteScreenCenterY + spriteHeight / 2;
+
+			rendering::PixelRect bounds = rendering::PixelRect{
+				std::max(spriteScreenLeft, 0),
+				std::max(spriteScreenTop, 0),
+				std::min(spriteScreenRight, (int)context.width),
+				std::min(spriteScreenBottom, (int)context.height) };
+
+			// Outside the sides of the frustum
+			if (bounds.right <= bounds.left || bounds.bottom <= bounds.top)
+			{
+				continue;
+			}
+
+			const float depth = spriteCameraPlaneDistance / camera.farPlane;
+
+			// Trim the columns hidden behind a wall from both sides, sprites fully behind
+			// walls are dropped here
+			while (bounds.left < bounds.right && rendering::isHiddenByWall(context, bounds.left, bounds.top, bounds.bottom, depth))
+			{
+				bounds.left++;
+			}
+
+			while (bounds.right > bounds.left && rendering::isHiddenByWall(context, bounds.right - 1, bounds.top, bounds.bottom, depth))
+			{
+				bounds.right--;
+			}
+
+			if (bounds.right <= bounds.left)
+			{
+				continue;
+			}
+
+			rendering::markDepthWritten(context, bounds);
+
+			projected[numVisible] = ProjectedSprite{
+				depth,
+				(uint32_t)s,
+				spriteScreenLeft,
+				spriteScreenTop,
+				spriteWidth,
+				spriteHeight,
+				bounds,
+				rendering::shadeAt(context, spriteCameraPlaneDistance, sprite.light) };
+
+			numVisible += 1;
+		}
+
+		const std::span<ProjectedSprite> visible = projected.first(numVisible);
+
+		std::sort(visible.begin(), visible.end(), [](const ProjectedSprite& a, const ProjectedSprite& b)
+			{
+				return a.depth < b.depth || (a.depth == b.depth && a.index < b.index);
+			});
+
+		// Bin the sprites by the tiles their bounds overlap, keeping the sorted order
+		const size_t tilesX = (context.width + spriteTileSize - 1) / spriteTileSize;
+		const size_t tilesY = (context.height + spriteTileSize - 1) / spriteTileSize;
+		const size_t numTiles = tilesX * tilesY;
+
+		const std::span<uint32_t> tileStart = context.frameArena.allocate<uint32_t>(numTiles + 1);
+		const std::span<uint32_t> tileCursor = context.frameArena.allocate<uint32_t>(numTiles);
+		std::fill(tileStart.begin(), tileStart.end(), 0);
+
+		const auto forEachTile = [&](const rendering::PixelRect& bounds, auto&& fn)
+			{
+				for (size_t ty = bounds.top / spriteTileSize; ty <= (bounds.bottom - 1) / spriteTileSize; ty++)
+				{
+					for (size_t tx = bounds.left / spriteTileSize; tx <= (bounds.right - 1) / spriteTileSize; tx++)
+					{
+						fn(ty * tilesX + tx);
+					}
+				}
+			};
+
+		for (const auto& sprite : visible)
+		{
+			forEachTile(sprite.bounds, [&](size_t tile) { tileStart[tile + 1] += 1; });
+		}
+
+		for (size_t t = 0; t < numTiles; t++)
+		{
+			tileStart[t + 1] += tileStart[t];
+			tileCursor[t] = tileStart[t];
+		}
+
+		const std::span<uint32_t> tileSprites = context.frameArena.allocate<uint32_t>(tileStart[numTiles]);
+
+		for (uint32_t v = 0; v < (uint32_t)visible.size(); v++)
+		{
+			forEachTile(visible[v].bounds, [&](size_t tile) { tileSprites[tileCursor[tile]++] = v; });
+		}
+
+		auto render = [&](size_t start, size_t end)
+			{
+				for (size_t tile = start; tile < end; tile++)
+				{
+					const int tileLeft = (int)((tile % tilesX) * spriteTileSize);
+					const int tileTop = (int)((tile / tilesX) * spriteTileSize);
+					const int tileRight = std::min(tileLeft + (int)spriteTileSize, (int)context.width);
+					const int tileBottom = std::min(tileTop + (int)spriteTileSize, (int)context.height);
+
+					for (uint32_t k = tileStart[tile]; k < tileStart[tile + 1]; k++)
+					{
+						const ProjectedSprite& sprite = visible[tileSprites[k]];
+						const texture::Texture& spriteTexture = textures[sprites[sprite.index].texture];
+						const media::ImageView& image = spriteTexture.mipmaps[0];
+						const texture::OpaqueRuns& opaqueRuns = spriteTexture.opaqueRuns;
+
+						const float texelsPerPixel = (float)image.width / sprite.screenWidth;
+						const float pixelsPerTexel = sprite.screenWidth / (float)image.width;
+
+						const int left = std::max(sprite.bounds.left, tileLeft);
+						const int right = std::min(sprite.bounds.right, tileRight);
+						const int top = std::max(sprite.bounds.top, tileTop);
+						const int bottom = std::min(sprite.bounds.bottom, tileBottom);
+
+						// Columns of the tile where a wall hides every row of the sprite
+						std::array<bool, spriteTileSize> columnHidden;
+						bool anyVisible = false;
+
+						for (int j = left; j < right; j++)
+						{
+							columnHidden[j - tileLeft] = rendering::isHiddenByWall(context, j, top, bottom, sprite.depth);
+							anyVisible |= !columnHidden[j - tileLeft];
+						}
+
+						if (!anyVisible)
+						{
+							continue;
+						}
+
+						for (int i = top; i < bottom; i++)
+						{
+							const auto uv = ds::Vec2(0.0f, -(float)((i - sprite.screenTop) / sprite.screenHeight));
+							const size_t row = sampler::footprintFromUV(image, uv).y0;
+							const ds::PackedColor* p_row = image.data + row * image.width;
+
+							for (uint32_t r = opaqueRuns.rowStart[row]; r < opaqueRuns.rowStart[row + 1]; r++)
+							{
+								const texture::OpaqueRuns::Run run = opaqueRuns.runs[r];
+
+								// Screen columns whose texel falls inside the run
+								const int runLeft = sprite.screenLeft + (int)std::ceil((float)run.start * pixelsPerTexel);
+								const int runRight = sprite.screenLeft + (int)std::ceil((float)run.end * pixelsPerTexel);
+
+								for (int j = std::max(runLeft, left); j < std::min(runRight, right); j++)
+								{
+									if (columnHidden[j - tileLeft] || rendering::isHiddenByWall(context, j, i, i + 1, sprite.depth))
+									{
+										continue;
+									}
+
+									if (context.depthBuffer[i * context.width + j] > sprite.depth)
+									{
+										// The runs already tell which pixels are opaque, a sprite fully in the
+										// fog reads no texel
+										ds::PackedColor color = sprite.shade.fog | sprite.shade.alphaMask;
+
+										if (!sprite.shade.fogOnly)
+										{
+											const size_t column = std::clamp((size_t)((float)(j - sprite.screenLeft) * texelsPerPixel), (size_t)run.start, (size_t)run.end - 1);
+
+											color = sprite.shade.scale != nullptr ? sampler::applyShade(sprite.shade, p_row[column]) : p_row[column];
+										}
+
+										rendering::setSceenBufferPixel(context, j, i, color);
+										rendering::setDepthBufferPixel(context, j, i, sprite.depth);
+									}
+								}
+							}
+						}
+					}
+				}
+			};
+
+		pool.parallelFor(numTiles, 1, render);
+	}
+
+
+	auto renderFloorAndCeiling(rendering::Context& context, threading::ThreadPool& pool, const camera::Camera& camera, const std::vector<texture::Texture>& textures)
+	{
+		const int screenCenterX = context.width / 2;
+		const int screenCenterY = context.height / 2;
+
+		const float eyeHeight = camera.height;
+		const float ceilingHeight = 2.0f - camera.height; // walls are two units tall
+		const float projectionPlaneHeight = std::tanf(camera.fov / 2);
+		const float projectionPlaneWidth = projectionPlaneHeight * rendering::aspectRatio(context);
+		const size_t numberOfRays = context.height / 2;
+		const float rayOffset = projectionPlaneHeight / numberOfRays;
+
+		const auto right = ds::Vec2(camera.front.y, -camera.front.x);
+		const float pixelWidth = projectionPlaneWidth / (float)(context.width / 2);
+
+		// Draws screen row y of a horizontal plane planeHeight away from the eye, i rows away
+		// from the horizon
+		auto renderRow = [&](const size_t y, const size_t i, const float planeHeight, const texture::Texture& planeTexture)
+			{
+				// Distance along the plane where the ray of this row hits it, the row at the
+				// horizon is clamped to half a row away from it
+				const float intersectionDistance = planeHeight / (std::max((float)i, 0.5f) * rayOffset);
+
+
+				// Pixel footprint on the plane, across the row and towards the next row
+				const float horizontalFootprint = pixelWidth * intersectionDistance;
+				const float verticalFootprint = intersectionDistance - planeHeight / ((float)(i + 1) * rayOffset);
+				const float texelsPerPixel = std::max(horizontalFootprint, verticalFootprint) * (float)planeTexture.width;
+
+				size_t mipMapLevel = texture::selectMipmapLevel(planeTexture, texelsPerPixel);
+				const auto& rowTexture = planeTexture.mipmaps[mipMapLevel * (int)context.useMipmap];
+
+				// UV is linear across the row, start at column 0 and step along the camera right vector
+				const ds::Vec2 uvStep = right * (pixelWidth * intersectionDistance);
+				const ds::Vec2 uvRowStart = camera.position + camera.front * intersectionDistance - uvStep * (float)screenCenterX;
+
+				uint32_t* p_row = rendering::screenRow(context, y);
+				const sampler::Shade shade = rendering::shadeAt(context, intersectionDistance, 1.0f);
+
+				// Sample every run of columns not covered by a wall as one span
+				size_t j = 0;
+
+				while (j < context.width)
+				{
+					if (rendering::isWallPixel(context, j, y))
+					{
+						j++;
+						continue;
+					}
+
+					const size_t runStart = j;
+
+					while (j < context.width && !rendering::isWallPixel(context, j, y))
+					{
+						j++;
+					}
+
+					sampler::sampleSpan(rowTexture, uvRowStart + uvStep * (float)runStart, uvStep, j - runStart, p_row + runStart, 1, context.useFiltering, shade);
+				}
+			};
+
+		// The lower half has one more row than numberOfRays when the height is odd. With the
+		// textured ceiling the upper half is drawn too, and the sky pass is skipped.
+		const size_t firstRow = context.useTexturedCeiling ? 0 : screenCenterY;
+
+		auto render = [&](size_t start, size_t end)
+			{
+				for (size_t y = start + firstRow; y < end + firstRow; ++y)
+				{
+					if (y >= (size_t)screenCenterY)
+					{
+						renderRow(y, y - screenCenterY, eyeHeight, textures[1]);
+					}
+					else
+					{
+						renderRow(y, screenCenterY - y, ceilingHeight, textures[1]);
+					}
+				}
+			};
+
+		pool.parallelFor(context.height - firstRow, rowTileSize, render);
+	}
+
+
+	// Rebuilds the sky lookup tables when the field of view or the resolution changed. They
+	// do not depend on the camera direction, turning only shifts the column angles.
+	auto updateSkyTables(rendering::SkyTables& tables, const size_t width, const size_t height, const float aspectRatio, const camera::Camera& camera)
+	{
+		if (tables.fov == camera.fov && tables.width == width && tables.height == height)
+		{
+			return;
+		}
+
+		constexpr float pi = glm::pi<float>();
+		constexpr float pi2 = 2 * pi;
+
+		const int screenCenterX = width / 2;
+		const int screenCenterY = height / 2;
+
+		tables.fov = camera.fov;
+		tables.width = width;
+		tables.height = height;
+
+		tables.columnU.resize(width);
+		tables.columnInverseLength.resize(width);
+		tables.rowTangent.resize(screenCenterY);
+
+		// Column rays are front + right * offset, their azimuth is the camera yaw minus
+		// atan(offset) and their horizontal length is sqrt(1 + offset^2)
+		for (size_t j = 0; j < width; j++)
+		{
+			const float dx = ((float)((int)j - screenCenterX) / (float)screenCenterX);
+			const float offset = dx * std::atan(camera.fov / 2.0f) * aspectRatio;
+
+			tables.columnU[j] = -std::atan(offset) / pi2;
+			tables.columnInverseLength[j] = 1.0f / std::sqrt(1.0f + offset * offset);
+		}
+
+		float maxTangent = 0.0f;
+
+		for (int i = 0; i < screenCenterY; i++)
+		{
+			const float dy = ((float)((screenCenterY - i) / (float)screenCenterY));
+
+			tables.rowTangent[i] = dy * std::sin(camera.fov / 2.0f);
+			maxTangent = std::max(maxTangent, tables.rowTangent[i]);
+		}
+
+		// Elevation of a pixel is atan(rowTangent * columnInverseLength), which never leaves
+		// [0, maxTangent], so it is interpolated from a table
+		tables.elevationScale = (float)(rendering::SkyTables::elevationTableSize - 1) / std::max(maxTangent, 1e-6f);
+
+		for (size_t k = 0; k < rendering::SkyTables::elevationTableSize; k++)
+		{
+			tables.elevationV[k] = 0.5f + std::atan((float)k / tables.elevationScale) / pi;
+		}
+	}
+
+
+	// Sky texel of column x in a row whose tangent, scaled by the elevation table, is
+	// rowTangent
+	auto sampleSky(const rendering::SkyTables& tables, const media::ImageView& skyTexture, const float yawU, const size_t x, const float rowTangent) -> ds::PackedColor
+	{
+		constexpr size_t lastEntry = rendering::SkyTables::elevationTableSize - 1;
+
+		const float position = std::min(rowTangent * tables.columnInverseLength[x], (float)lastEntry);
+		const size_t entry = std::min((size_t)position, lastEntry - 1);
+		const float fraction = position - (float)entry;
+		const float uvY = tables.elevationV[entry] + (tables.elevationV[entry + 1] - tables.elevationV[entry]) * fraction;
+
+		return sampler::sample<true>(skyTexture, ds::Vec2(tables.columnU[x] + yawU, uvY));
+	}
+
+
+	auto renderBackground(rendering::Context& context, threading::ThreadPool& pool, const camera::Camera& camera, const std::vector<texture::Texture>& textures)
+	{
+		if (context.useTexturedCeiling)
+		{
+			return;
+		}
+
+		constexpr float pi2 = 2 * glm::pi<float>();
+
+		const int screenCenterY = context.height / 2;
+		const media::ImageView& skyTexture = textures[4].mipmaps[0];
+
+		rendering::SkyTables& tables = context.skyTables;
+		updateSkyTables(tables, context.width, context.height, rendering::aspectRatio(context), camera);
+
+		const float yawU = 0.5f + std::atan2(camera.front.y, camera.front.x) / pi2;
+
+		auto render = [&](size_t start, size_t end)
+			{
+				for (size_t i = start; i < end; i++)
+				{
+					const float rowTangent = tables.rowTangent[i] * tables.elevationScale;
+
+					for (size_t j = 0; j < context.width; j++)
+					{
+						if (rendering::isWallPixel(context, j, i))
+						{
+							continue;
+						}
+
+						rendering::setSceenBufferPixel(context, j, i, sampleSky(tables, skyTexture, yawU, j, rowTangent));
+					}
+				}
+			};
+
+		pool.parallelFor(screenCenterY, rowTileSize, render);
+	}
+
+	// Portal renderer of sector maps, replaces the wall, floor and ceiling, and background
+	// passes. Every column starts in the sector of the camera inside a window of all rows
+	// and walks through the portals it sees front to back. The ceiling, the walls and the
+	// floor of each sector fill the rows of the window they cover and the opening of the
+	// portal becomes the next window, so each pixel is written once and nothing behind a
+	// solid wall is visited. The column is written to the wall buffer with its depth, the
+	// wall span covers it whole so the resolve copies it and the sprites test the depth.
+	auto renderSectors(rendering::Context& context, threading::ThreadPool& pool, const camera::Camera& camera, const sector::SectorMap& map, const texture::TextureAtlas& atlas, const std::vector<texture::Texture>& textures)
+	{
+		constexpr float pi2 = 2 * glm::pi<float>();
+		constexpr size_t maxPortals = 256;
+		constexpr float nearDistance = 1e-3f;
+		constexpr float edgeTolerance = 1e-4f;
+
+		// Around a camera outside every sector there is only ground and sky
+		constexpr sector::Sector outside = sector::Sector{ 0.0f, 1.0f, true, 1.0f, 0, 0 };
+
+		const size_t width = context.width;
+		const size_t height = context.height;
+		const float screenCenterY = (float)(height / 2);
+
+		const rendering::RayTables& rays = context.rayTables;
+		updateRayTables(context.rayTables, width, height, rendering::aspectRatio(context), camera);
+
+		const rendering::SkyTables& sky = context.skyTables;
+		updateSkyTables(context.skyTables, width, height, rendering::aspectRatio(context), camera);
+
+		// Rows per unit of height at a camera plane distance of 1, and the width of a column
+		// on the projection plane
+		const float rowsPerUnit = (float)height / rays.projectionPlaneHeight;
+		const float columnWidth = rays.projectionPlaneHeight * rendering::aspectRatio(context) / (float)width;
+
+		// Camera plane distance of each row on a plane one unit above or below the eye and the
+		// pixel footprint there, both scale with the height of the plane
+		const std::span<float> rowDistance = context.frameArena.allocate<float>(height);
+		const std::span<float> rowFootprint = context.frameArena.allocate<float>(height);
+
+		for (size_t y = 0; y < height; y++)
+		{
+			const float fromHorizon = std::abs((float)y - screenCenterY);
+
+			rowDistance[y] = rowsPerUnit / std::max(fromHorizon, 0.5f);
+			rowFootprint[y] = std::max(columnWidth * rowDistance[y], rowDistance[y] - rowsPerUnit / (fromHorizon + 1.0f));
+		}
+
+		const std::optional cameraSector = sector::locateSector(map, camera.position);
+		const sector::Sector& firstSector = cameraSector.has_value() ? map.sectors[cameraSector.value()] : outside;
+
+		const ds::Vec2 rightVector = ds::Vec2(camera.front.y, -camera.front.x);
+		const float yawU = 0.5f + std::atan2(camera.front.y, camera.front.x) / pi2;
+
+		const texture::Texture& planeTexture = textures[1];
+		const media::ImageView& skyTexture = textures[4].mipmaps[0];
+
+		auto render = [&](size_t start, size_t end)
+			{
+				for (size_t x = start; x < end; x++)
+				{
+					// Screen columns run against the ray tables, see renderWalls
+					const size_t ray = width - (x + 1);
+					const ds::Vec2 direction = camera.front * rays.forward[ray] + rightVector * rays.right[ray];
+					const ds::Vec2 planeDirection = direction / rays.forward[ray];
+
+					uint32_t* p_column = &context.wallBuffer[x * height];
+					float farthest = 0.0f;
+
+					int top = 0;
+					int bottom = (int)height;
+
+					const auto writeDepth = [&](const int from, const int to, const float depth)
+						{
+							for (int y = from; y < to; y++)
+							{
+								rendering::setDepthBufferPixel(context, x, (size_t)y, depth);
+							}
+
+							farthest = from < to ? std::max(farthest, depth) : farthest;
+						};
+
+					// First row below worldHeight on a surface at distance, inside the window
+					const auto rowOf = [&](const float worldHeight, const float distance) -> int
+						{
+							const float row = screenCenterY - (worldHeight - camera.height) * rowsPerUnit / distance;
+
+							return (int)std::ceil(std::clamp(row, (float)top, (float)bottom));
+						};
+
+					// Rows [from, to) of a horizontal plane planeHeight above or below the eye. A
+					// camera on the wrong side of the plane sees it from right next to it.
+					const auto drawPlane = [&](const int from, const int to, float planeHeight, const float light)
+						{
+							planeHeight = std::max(planeHeight, nearDistance);
+
+							for (int y = from; y < to; y++)
+							{
+								const float distance = planeHeight * rowDistance[y];
+								const float depth = std::min(distance / camera.farPlane, 1.0f);
+								const sampler::Shade shade = rendering::shadeAt(context, distance, light);
+
+								rendering::setDepthBufferPixel(context, x, (size_t)y, depth);
+								farthest = std::max(farthest, depth);
+
+								if (shade.fogOnly)
+								{
+									p_column[y] = shade.fog | shade.alphaMask;
+									continue;
+								}
+
+								const size_t mipMapLevel = texture::selectMipmapLevel(planeTexture, planeHeight * rowFootprint[y] * (float)planeTexture.width);
+								const media::ImageView& image = planeTexture.mipmaps[mipMapLevel * (int)context.useMipmap];
+								const ds::Vec2 uv = camera.position + planeDirection * distance;
+
+								const ds::PackedColor texel = context.useFiltering ? sampler::sample<true>(image, uv) : sampler::sample<false>(image, uv);
+
+								p_column[y] = shade.scale != nullptr ? sampler::applyShade(shade, texel) : texel;
+							}
+						};
+
+					// Rows below the horizon show the sky at the horizon
+					const auto drawSky = [&](const int from, const int to)
+						{
+							for (int y = from; y < to; y++)
+							{
+								const float rowTangent = (size_t)y < sky.rowTangent.size() ? sky.rowTangent[y] * sky.elevationScale : 0.0f;
+
+								p_column[y] = sampleSky(sky, skyTexture, yawU, x, rowTangent);
+							}
+
+							writeDepth(from, to, 1.0f);
+						};
+
+					const auto drawCeiling = [&](const sector::Sector& sector, const int from, const int to)
+						{
+							if (sector.hasSky)
+							{
+								drawSky(from, to);
+							}
+							else
+							{
+								drawPlane(from, to, sector.ceilingHeight - camera.height, sector.light);
+							}
+						};
+
+					// Texture V is the world height, linear in the screen row
+					const auto drawWall = [&](const int from, const int to, const media::ImageView& image, const float distance, const float wallOffset, const float light)
+						{
+							if (from >= to)
+							{
+								return;
+							}
+
+							const float uvStepY = distance / rowsPerUnit;
+							const ds::Vec2 uv = ds::Vec2(wallOffset, camera.height + (screenCenterY - (float)from) * uvStepY);
+
+							sampler::sampleSpan(image, uv, ds::Vec2(0.0f, -uvStepY), to - from, p_column + from, 1, context.useFiltering, rendering::shadeAt(context, distance, light));
+							writeDepth(from, to, std::min(distance / camera.farPlane, 1.0f));
+						};
+
+					const sector::Sector* p_sector = &firstSector;
+
+					for (size_t step = 0; step < maxPortals && top < bottom; step++)
+					{
+						// The ray leaves a convex sector through the first edge it crosses on its way
+						// out of the inside of that edge. Edges on one line are hit at the same
+						// distance, the one the hit lies on wins.
+						float exitDistance = std::numeric_limits<float>::infinity();
+						uint32_t exitEdge = sector::noNeighbor;
+						bool exitOnEdge = false;
+
+						for (uint32_t k = p_sector->firstEdge; k < p_sector->firstEdge + p_sector->edgeCount; k++)
+						{
+							const Line& line = map.walls[k].line;
+							const ds::Vec2 edge = line.end - line.start;
+							const ds::Vec2 outward = ds::Vec2(edge.y, -edge.x);
+							const float facing = glm::dot(direction, outward);
+
+							if (facing > 0.0f)
+							{
+								const float t = glm::dot(line.start - camera.position, outward) / facing;
+								const float u = glm::dot(camera.position + direction * t - line.start, edge) / glm::dot(edge, edge);
+								const bool onEdge = u >= -edgeTolerance && u <= 1.0f + edgeTolerance;
+
+								if ((onEdge && !exitOnEdge) || (onEdge == exitOnEdge && t < exitDistance))
+								{
+									exitDistance = t;
+									exitEdge = k;
+									exitOnEdge = onEdge;
+								}
+							}
+						}
+
+						if (exitEdge == sector::noNeighbor)
+						{
+							break;
+						}
+
+						const sector::Sector& current = *p_sector;
+						const wall::Wall& wall = map.walls[exitEdge];
+						const ds::Vec2 edge = wall.line.end - wall.line.start;
+						const float edgeLength = glm::length(edge);
+
+						const float distance = std::max(exitDistance * rays.forward[ray], nearDistance);
+						const float wallOffset = glm::dot(camera.position + direction * exitDistance - wall.line.start, edge) / edgeLength;
+
+						// Pixel footprint on the wall, vertically from the projection and horizontally
+						// from the angle the ray meets the wall at
+						const float incidence = std::abs(glm::dot(direction, ds::Vec2(edge.y, -edge.x))) / edgeLength;
+						const float footprint = std::max(distance / rowsPerUnit, distance * columnWidth / std::max(incidence, nearDistance));
+						const texture::TextureAtlas::Material& material = atlas.materials[wall.material < atlas.materials.size() ? wall.material : 0];
+						const size_t mipMapLevel = texture::selectMipmapLevel(material.levelCount, footprint * material.width);
+						const media::ImageView& wallImage = atlas.levels[material.firstLevel + mipMapLevel * (int)context.useMipmap];
+
+						const int floorRow = rowOf(current.floorHeight, distance);
+						const uint32_t neighbor = map.neighbors[exitEdge];
+
+						if (neighbor == sector::noNeighbor)
+						{
+							const int wallRow = rowOf(std::min(current.floorHeight + wall.height, current.ceilingHeight), distance);
+
+							drawCeiling(current, top, wallRow);
+							drawWall(wallRow, floorRow, wallImage, distance, wallOffset, current.light);
+							drawPlane(floorRow, bottom, camera.height - current.floorHeight, current.light);
+
+							top = bottom;
+							break;
+						}
+
+						// The opening of the portal. Between two sky sectors the higher sky wins, so
+						// what rises above the lower one beyond stays visible.
+						const sector::Sector& next = map.sectors[neighbor];
+						const bool bothSky = current.hasSky && next.hasSky;
+
+						const float openingTop = bothSky ? std::max(current.ceilingHeight, next.ceilingHeight) : std::min(current.ceilingHeight, next.ceilingHeight);
+						const float openingBottom = std::max(current.floorHeight, next.floorHeight);
+
+						const int ceilingRow = rowOf(bothSky ? openingTop : current.ceilingHeight, distance);
+						const int openingTopRow = rowOf(openingTop, distance);
+						const int openingBottomRow = std::max(rowOf(openingBottom, distance), openingTopRow);
+
+						drawCeiling(current, top, ceilingRow);
+						drawWall(ceilingRow, openingTopRow, wallImage, distance, wallOffset, current.light);
+						drawWall(openingBottomRow, floorRow, wallImage, distance, wallOffset, current.light);
+						drawPlane(floorRow, bottom, camera.height - current.floorHeight, current.light);
+
+						top = openingTopRow;
+						bottom = openingBottomRow;
+						p_sector = &next;
+					}
+
+					// Rays that leave the map, or pass through too many portals, see the planes of
+					// the last sector up to the horizon
+					if (top < bottom)
+					{
+						const int horizonRow = std::clamp((int)screenCenterY, top, bottom);
+
+						drawCeiling(*p_sector, top, horizonRow);
+						drawPlane(horizonRow, bottom, camera.height - p_sector->floorHeight, p_sector->light);
+					}
+
+					context.wallSpans[x] = rendering::WallSpan{ 0, (int)height, farthest };
+				}
+			};
+
+		pool.parallelFor(width, columnTileSize, render);
+	}
+
+
+	// Profiler graph in the top left corner, one column per recent frame with the time of
+	// each pass stacked from the bottom. The line marks 60 fps.
+	auto renderProfilerOverlay(rendering::Context& context, const profiler::Profiler& profiler)
+	{
+		constexpr std::array<uint32_t, profiler::passCount> passColors =
+		{
+			ds::packColor(230, 80, 60, 255),
+			ds::packColor(240, 170, 40, 255),
+			ds::packColor(90, 200, 80, 255),
+			ds::packColor(80, 160, 240, 255),
+			ds::packColor(200, 90, 220, 255),
+			ds::packColor(170, 170, 170, 255),
+		};
+
+		constexpr float pixelsPerMillisecond = 4.0f;
+		constexpr float targetFrameTime = 1000.0f / 60.0f;
+
+		const int graphWidth = (int)std::min<size_t>({ 256, context.width, profiler::Profiler::historySize });
+		const int graphHeight = (int)std::min<size_t>(128, context.height);
+		const int numFrames = (int)std::min<size_t>(graphWidth, profiler.numFrames());
+
+		const uint32_t alphaMask = 0xFFu << context.pixelLayout.a;
+
+		for (int y = 0; y < graphHeight; y++)
+		{
+			uint32_t* p_row = rendering::screenRow(context, y);
+
+			for (int x = 0; x < graphWidth; x++)
+			{
+				p_row[x] = ((p_row[x] >> 1) & 0x7F7F7F7F & ~alphaMask) | alphaMask;
+			}
+		}
+
+		for (int i = 0; i < numFrames; i++)
+		{
+			const profiler::FrameSample& sample = profiler.frame(i);
+			const int x = graphWidth - 1 - i;
+
+			int y = graphHeight;
+			float stacked = 0.0f;
+
+			for (size_t pass = 0; pass < profiler::passCount && y > 0; pass++)
+			{
+				stacked += sample.passTimes[pass];
+
+				const int top = std::max(0, graphHeight - (int)(stacked * pixelsPerMillisecond));
+
+				for (; y > top; y--)
+				{
+					rendering::setSceenBufferPixel(context, x, y - 1, ds::convertColor(passColors[pass], context.pixelLayout));
+				}
+			}
+		}
+
+		const int targetY = graphHeight - (int)(targetFrameTime * pixelsPerMillisecond);
+
+		if (targetY >= 0)
+		{
+			std::fill_n(rendering::screenRow(context, targetY), graphWidth, ds::packColor(255, 255, 255, 255));
+		}
+	}
+
+	// Everything a frame is rendered from besides the level and its textures. A frame with
+	// the same inputs as the last one over an unchanged level would be identical to it.
+	struct FrameInputs
+	{
+		glm::mat3 cameraTransform;
+		float cameraHeight;
+		float fov;
+		float farPlane;
+
+		size_t width;
+		size_t height;
+
+		bool useMipmap;
+		bool useFiltering;
+		bool useTexturedCeiling;
+		bool useLockedTexture;
+
+		// Changes whenever the level does, chunks swapped in or anything moved
+		size_t levelVersion;
+
+		auto operator==(const FrameInputs&) const -> bool = default;
+	};
+
+
+	auto frameInputs(const rendering::Context& context, const camera::Camera& camera, const size_t levelVersion) -> FrameInputs
+	{
+		return FrameInputs{
+			camera::getTransform(camera), camera.height, camera.fov, camera.farPlane,
+			context.width, context.height,
+			context.useMipmap, context.useFiltering, context.useTexturedCeiling, context.useLockedTexture,
+			levelVersion };
+	}
+
+
+	// Renders one frame into the render target without presenting it. Only touches the
+	// context members the passes own, see renderContext.
+	auto renderFrame(
+		rendering::Context& context,
+		threading::ThreadPool& pool,
+		profiler::Profiler& profiler,
+		const camera::Camera& camera,
+		const std::vector<wall::Wall>& level,
+		const spatial::WallGrid& grid,
+		const std::vector<texture::Texture>& textures,
+		const texture::TextureAtlas& atlas,
+		const std::vector<rendering::Sprite>& sprites)
+	{
+		using profiler::Pass;
+		using profiler::ScopedTimer;
+
+		rendering::clearContext(context);
+
+		{
+			ScopedTimer timer(profiler, Pass::Walls);
+			renderWalls(context, pool, camera, level, grid, atlas);
+		}
+		{
+			ScopedTimer timer(profiler, Pass::Resolve);
+			resolveWalls(context, pool);
+		}
+		{
+			ScopedTimer timer(profiler, Pass::FloorAndCeiling);
+			renderFloorAndCeiling(context, pool, camera, textures);
+		}
+		{
+			ScopedTimer timer(profiler, Pass::Background);
+			renderBackground(context, pool, camera, textures);
+		}
+		{
+			ScopedTimer timer(profiler, Pass::Sprites);
+			renderSprites(context, pool, camera, sprites, textures);
+		}
+
+		if (context.showProfilerOverlay)
+		{
+			renderProfilerOverlay(context, profiler);
+		}
+	}
+
+
+	// renderFrame for a sector map, the portal renderer draws everything but the sprites
+	auto renderSectorFrame(
+		rendering::Context& context,
+		threading::ThreadPool& pool,
+		profiler::Profiler& profiler,
+		const camera::Camera& camera,
+		const sector::SectorMap& map,
+		const std::vector<texture::Texture>& textures,
+		const texture::TextureAtlas& atlas)
+	{
+		using profiler::Pass;
+		using profiler::ScopedTimer;
+
+		rendering::clearContext(context);
+
+		{
+			ScopedTimer timer(profiler, Pass::Walls);
+			renderSectors(context, pool, camera, map, atlas, textures);
+		}
+		{
+			ScopedTimer timer(profiler, Pass::Resolve);
+			resolveWalls(context, pool);
+		}
+		{
+			ScopedTimer timer(profiler, Pass::Sprites);
+			renderSprites(context, pool, camera, map.sprites, textures);
+		}
+
+		if (context.showProfilerOverlay)
+		{
+			renderProfilerOverlay(context, profiler);
+		}
+	}
+
+
+	// A camera rendered into its own rectangle of the frame. The view owns the buffers and
+	// tables of the passes, the level and the textures are shared with the other views.
+	struct View
+	{
+		camera::Camera camera;
+
+		// Rectangle of the frame at the output resolution, renderViews scales it with the
+		// render resolution
+		rendering::PixelRect rect;
+
+		rendering::Context context;
+
+		View(const rendering::PixelRect rect) :
+			camera(),
+			rect(rect),
+			context(rect.right - rect.left, rect.bottom - rect.top)
+		{
+		}
+	};
+
+
+	// Splits a width x height frame into count rectangles, rows of up to ceil(sqrt(count))
+	// views from the top left. The last row shares its width between the views left over.
+	auto splitScreen(const size_t width, const size_t height, const size_t count) -> std::vector<rendering::PixelRect>
+	{
+		const size_t columns = (size_t)std::ceil(std::sqrt((float)count));
+		const size_t rows = (count + columns - 1) / columns;
+
+		std::vector<rendering::PixelRect> rects;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			const size_t row = i / columns;
+			const size_t column = i % columns;
+			const size_t rowColumns = row + 1 < rows ? columns : count - row * columns;
+
+			rects.push_back(rendering::PixelRect{
+				(int)(column * width / rowColumns),
+				(int)(row * height / rows),
+				(int)((column + 1) * width / rowColumns),
+				(int)((row + 1) * height / rows) });
+		}
+
+		return rects;
+	}
+
+
+	// Renders every view into its rectangle of the render target of context, which holds the
+	// whole frame. renderView(viewContext, camera) renders one view, the views are tasks on
+	// the pool at the same time so the passes of one fill the threads the others leave idle.
+	auto renderViews(rendering::Context& context, threading::ThreadPool& pool, profiler::Profiler& profiler, std::vector<View>& views, auto&& renderView)
+	{
+		// Edges shared by two views stay shared at any render resolution
+		const auto scaleX = [&](const int x) { return (int)((size_t)x * context.width / context.outputWidth); };
+		const auto scaleY = [&](const int y) { return (int)((size_t)y * context.height / context.outputHeight); };
+
+		for (View& view : views)
+		{
+			const int left = scaleX(view.rect.left);
+			const int top = scaleY(view.rect.top);
+
+			rendering::resizeContext(view.context, scaleX(view.rect.right) - left, scaleY(view.rect.bottom) - top);
+
+			view.context.pixelLayout = context.pixelLayout;
+			view.context.useMipmap = context.useMipmap;
+			view.context.useFiltering = context.useFiltering;
+			view.context.useTexturedCeiling = context.useTexturedCeiling;
+			view.context.fog = context.fog;
+
+			view.context.targetPixels = context.targetPixels + (size_t)top * context.targetPitch + (size_t)left;
+			view.context.targetPitch = context.targetPitch;
+		}
+
+		pool.parallelFor(views.size(), 1, [&](size_t start, size_t end)
+			{
+				for (size_t i = start; i < end; i++)
+				{
+					renderView(views[i].context, views[i].camera);
+				}
+			});
+
+		for (View& view : views)
+		{
+			view.context.targetPixels = nullptr;
+		}
+
+		if (context.showProfilerOverlay)
+		{
+			renderProfilerOverlay(context, profiler);
+		}
+	}
+
+
+	// Frame finished by renderBatch, pixels are packed in the layout of its context and rows
+	// are pitch pixels apart. They are only valid until the callback returns.
+	struct BatchFrame
+	{
+		size_t index;
+
+		const uint32_t* pixels;
+		size_t width;
+		size_t height;
+		size_t pitch;
+	};
+
+
+	// Renders one frame per camera with renderView(context, camera) and hands them to
+	// onFrame(frame) in camera order on the calling thread, straight from the buffers they
+	// were rendered into. The contexts are headless and each renders one camera of a round,
+	// while onFrame reads a round from the present buffers the next round renders into the
+	// screen buffers on the pool.
+	auto renderBatch(std::vector<rendering::Context>& contexts, threading::ThreadPool& pool, const std::vector<camera::Camera>& cameras, auto&& renderView, auto&& onFrame)
+	{
+		// Cameras [presentFirst, presentFirst + presentCount) wait in the present buffers
+		size_t presentFirst = 0;
+		size_t presentCount = 0;
+
+		auto deliver = [&]()
+			{
+				for (size_t i = 0; i < presentCount; i++)
+				{
+					const rendering::Context& context = contexts[i];
+
+					onFrame(BatchFrame{ presentFirst + i, context.presentBuffer.data(), context.presentWidth, context.presentHeight, context.presentWidth });
+				}
+			};
+
+		for (size_t first = 0; first < cameras.size(); first += contexts.size())
+		{
+			const size_t count = std::min(contexts.size(), cameras.size() - first);
+
+			auto renderRound = [&](size_t start, size_t end)
+				{
+					for (size_t i = start; i < end; i++)
+					{
+						rendering::acquireRenderTarget(contexts[i]);
+						renderView(contexts[i], cameras[first + i]);
+					}
+				};
+
+			threading::JobHandle roundJob;
+			pool.dispatch(roundJob, count, 1, renderRound);
+
+			deliver();
+
+			pool.wait(roundJob);
+
+			for (size_t i = 0; i < count; i++)
+			{
+				rendering::releaseRenderTarget(contexts[i]);
+			}
+
+			presentFirst = first;
+			presentCount = count;
+		}
+
+		deliver();
+	}
+
+
+	// Renders and presents one frame on the calling thread
+	auto renderMain(
+		rendering::Context& context,
+		threading::ThreadPool& pool,
+		profiler::Profiler& profiler,
+		const camera::Camera& camera,
+		const std::vector<wall::Wall>& level,
+		const spatial::WallGrid& grid,
+		const std::vector<texture::Texture>& textures,
+		const texture::TextureAtlas& atlas,
+		const std::vector<rendering::Sprite>& sprites)
+	{
+		rendering::acquireRenderTarget(context);
+		renderFrame(context, pool, profiler, camera, level, grid, textures, atlas, sprites);
+		rendering::releaseRenderTarget(context);
+
+		profiler::ScopedTimer timer(profiler, profiler::Pass::Present);
+		rendering::renderContext(context);
+	}
+}
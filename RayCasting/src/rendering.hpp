@@ -2,7 +2,14 @@
 
 #include <glm/vec4.hpp>
 
+#include <algorithm>
+#include <array>
+#include <utility>
+
 #include "sdl.hpp"
+#include "memory.hpp"
+#include "texture.hpp"
+#include "sampler.hpp"
 
 
 namespace rendering
@@ -10,108 +17,301 @@ namespace rendering
 	template <typename T>
 	using ScreenBuffer = std::vector<T>;
 
-	struct Texture
-	{
-		std::vector<media::Image> mipmaps;
-
-		size_t width;
-		size_t height;
-	};
+	// Index into the texture array loaded at startup. Objects refer to textures through
+	// it, so every sprite of a kind shares the same pixels.
+	using TextureId = uint32_t;
 
 	
 	struct Sprite
 	{
-		Texture texture;
+		TextureId texture;
 
 		ds::Vec2 position;
 		float size;
 		float height;
+
+		// Light level of the place the sprite stands in, from 0 to 1
+		float light = 1.0f;
 	};
 
 
-	auto spriteFromTexture(rendering::Texture& texture) -> rendering::Sprite
+	auto spriteFromTexture(const TextureId texture) -> rendering::Sprite
 	{
-		return rendering::Sprite{ rendering::Texture{texture.mipmaps, texture.width, texture.height}, ds::Vec2(0.0f, 0.0f), 1.0f, 0.0f};
+		return rendering::Sprite{ texture, ds::Vec2(0.0f, 0.0f), 1.0f, 0.0f};
 	}
 
 
-	auto minifyImage(const media::Image& image) -> media::Image
+	// Rows [top, bottom) of a screen column covered by a wall, all at the same depth
+	struct WallSpan
+	{
+		int top;
+		int bottom;
+		float depth;
+	};
+
+
+	// Screen rectangle [left, right) x [top, bottom), empty when right <= left
+	struct PixelRect
+	{
+		int left;
+		int top;
+		int right;
+		int bottom;
+	};
+
+
+	// Camera space direction of the ray of every column, valid for the field of view and
+	// resolution stored with them. A world direction is front * forward + right * right,
+	// and forward is also the cosine that turns ray distance into camera plane distance.
+	struct RayTables
+	{
+		float fov = 0.0f;
+		size_t width = 0;
+		size_t height = 0;
+
+		float projectionPlaneHeight = 0.0f;
+
+		std::vector<float> forward;
+		std::vector<float> right;
+	};
+
+
+	// Lookup tables of the sky pass, valid for the field of view and resolution stored
+	// with them
+	struct SkyTables
 	{
-		auto result = media::Image(image.width / 2, image.height / 2);
+		static constexpr size_t elevationTableSize = 1024;
+
+		float fov = 0.0f;
+		size_t width = 0;
+		size_t height = 0;
+
+		// Texture U of each column relative to the camera yaw
+		std::vector<float> columnU;
+		// One over the horizontal length of each column ray
+		std::vector<float> columnInverseLength;
+		// Vertical component of each row ray in the upper half
+		std::vector<float> rowTangent;
+
+		// Texture V for tangents from 0 to the largest one, elevationScale entries per unit
+		std::array<float, elevationTableSize> elevationV{};
+		float elevationScale = 0.0f;
+	};
 
-		for (int i = 0; i < result.height; i++)
+
+	// Light levels of the shade tables, level l scales a channel by l / (shadeLevels - 1)
+	constexpr size_t shadeLevels = 64;
+
+	constexpr auto shadeScale = []()
 		{
-			for (int j = 0; j < result.width; j++)
+			std::array<std::array<uint8_t, 256>, shadeLevels> table{};
+
+			for (size_t level = 0; level < shadeLevels; level++)
 			{
-				int _i = 2 * i;
-				int _j = 2 * j;
-				result.data[i*result.width + j] = (
-					image.data[_i       * image.width + _j    ] +
-					image.data[_i       * image.width + _j + 1] +
-					image.data[(_i + 1) * image.width + _j    ] +
-					image.data[(_i + 1) * image.width + _j + 1])/4;
+				for (size_t value = 0; value < 256; value++)
+				{
+					table[level][value] = (uint8_t)(value * level / (shadeLevels - 1));
+				}
 			}
-		}
 
-		return result;
-	}
+			return table;
+		}();
 
 
-	auto createTexture(const media::Image&& image) -> Texture
+	// Surfaces fade from their own color at fogStart to fogColor at fogEnd, camera plane
+	// distances. There is no fog when fogEnd is not past fogStart.
+	struct Fog
 	{
-		media::Image m1 = image;
-		media::Image m2 = std::move(minifyImage(m1));
-		media::Image m3 = std::move(minifyImage(m2));
-		media::Image m4 = std::move(minifyImage(m3));
-
-		return Texture{ {m1, m2, m3, m4}, m1.width, m1.height };
-	}
+		float fogStart = 0.0f;
+		float fogEnd = 0.0f;
+		ds::ColorRGB fogColor = ds::ColorRGB(0);
+	};
 
 
 	struct Context
 	{
 		SDL::SDLWindowPtr window;
 		SDL::SDLRendererPtr renderer;
-		SDL::SDLTexturePtr screenTexture;
 		size_t width, height;
+
+		// Size of the window, or of a headless context when it was created. Buffers and
+		// textures are allocated for it once, the passes render width x height of them and
+		// the renderer scales that up to the window, see resizeContext.
+		size_t outputWidth, outputHeight;
+
 		ScreenBuffer<uint32_t> screenBuffer;
-		ScreenBuffer<uint8_t> stencilBuffer;
 		ScreenBuffer<float> depthBuffer;
 
+		// Last finished frame. It is uploaded and presented while the passes render the
+		// next one into screenBuffer, see releaseRenderTarget.
+		ScreenBuffer<uint32_t> presentBuffer;
+
+		// Streaming textures in the window format. With useLockedTexture the passes write
+		// straight into the locked back texture while the front one is presented, otherwise
+		// presentBuffer is uploaded into the front one.
+		std::array<SDL::SDLTexturePtr, 2> screenTextures;
+		size_t frontTexture = 0;
+		// The front texture already holds the frame to present
+		bool presentFromTexture = false;
+
+		// Resolution of the frame handed to renderContext, the next one may already render
+		// at another one
+		size_t presentWidth = 0;
+		size_t presentHeight = 0;
+
+		// Layout of the screen textures, colors written by the passes have to use it
+		ds::PixelLayout pixelLayout = ds::rgbaLayout;
+
+		// Pixels the passes write this frame, rows are targetPitch pixels apart. Set by
+		// acquireRenderTarget to the locked back texture or to screenBuffer.
+		uint32_t* targetPixels = nullptr;
+		size_t targetPitch = 0;
+		bool targetLocked = false;
+
+		// Part of the depth buffer written this frame. Walls keep their depth in wallSpans,
+		// so only what sprites touched has to be reset for the next frame.
+		PixelRect depthWritten = PixelRect{ 0, 0, 0, 0 };
+
+		// Walls are drawn column major, so every span is contiguous in memory, and copied
+		// to the screen buffer in one pass afterwards. Only the rows inside wallSpans are
+		// valid, the buffer is never cleared.
+		ScreenBuffer<uint32_t> wallBuffer;
+		ScreenBuffer<WallSpan> wallSpans;
+
+		// Scratch memory for the render passes, reset at the start of every frame
+		memory::FrameArena frameArena;
+
+		RayTables rayTables;
+		SkyTables skyTables;
+
+		Fog fog;
+
 		bool useMipmap = true;
 		bool useFiltering = true;
+		bool useTexturedCeiling = false;
+		bool showProfilerOverlay = false;
+		bool useLockedTexture = true;
 
-		Context(SDL::SDLWindowPtr&& window, SDL::SDLRendererPtr&& renderer, size_t width, size_t height) :
-			window (std::move(window)),
-			renderer(std::move(renderer)),
+		// Headless context, frames are rendered into the screen buffer and never presented
+		Context(size_t width, size_t height) :
 			screenBuffer(width * height),
-			stencilBuffer(width * height),
 			depthBuffer(width * height, 1.0f),
+			presentBuffer(width * height),
+			wallBuffer(width * height),
+			wallSpans(width, WallSpan{ 0, 0, 1.0f }),
+			frameArena(1 << 20),
 			width(width),
-			height(height)
+			height(height),
+			outputWidth(width),
+			outputHeight(height),
+			presentWidth(width),
+			presentHeight(height)
 		{
-			screenTexture = *SDL::createTexture(this->renderer, width, height);
+		}
+
+		Context(SDL::SDLWindowPtr&& window, SDL::SDLRendererPtr&& renderer, size_t width, size_t height) :
+			Context(width, height)
+		{
+			this->window = std::move(window);
+			this->renderer = std::move(renderer);
+
+			const uint32_t format = SDL::nativePixelFormat(this->window);
+			pixelLayout = *SDL::pixelLayout(format);
+
+			for (auto& texture : screenTextures)
+			{
+				texture = *SDL::createTexture(this->renderer, width, height, format);
+			}
 		}
 	};
 
 
-	auto setSceenBufferPixel(Context& context, const size_t x, const size_t y, const glm::u8vec4& color)
+	// Shape of the picture on screen, which does not change with the render resolution. The
+	// passes project with it, so scaling one axis only changes the size of the pixels.
+	auto aspectRatio(const Context& context) -> float
+	{
+		return (float)context.outputWidth / (float)context.outputHeight;
+	}
+
+
+	// Renders the next frames at width x height, clamped to the output size. The buffers
+	// keep their allocation, only the depth buffer is reset because its rows move. Must not
+	// be called between acquireRenderTarget and releaseRenderTarget.
+	auto resizeContext(Context& context, size_t width, size_t height)
 	{
-		std::array<uint8_t, 4> colorDWord = 
+		width = std::clamp<size_t>(width, 2, context.outputWidth);
+		height = std::clamp<size_t>(height, 2, context.outputHeight);
+
+		if (width == context.width && height == context.height)
 		{
-			(uint8_t)(color.a),
-			(uint8_t)(color.b),
-			(uint8_t)(color.g),
-			(uint8_t)(color.r),
-		};
+			return;
+		}
 
-		context.screenBuffer[y * context.width + x] = *((uint32_t*)colorDWord.data());
+		context.width = width;
+		context.height = height;
+
+		std::fill(context.depthBuffer.begin(), context.depthBuffer.end(), 1.0f);
+		context.depthWritten = PixelRect{ 0, 0, 0, 0 };
 	}
 
 
-	auto setStencilBufferPixel(Context& context, const size_t x, const size_t y, uint8_t value)
+	// Shade of a surface at a camera plane distance under a light level from 0 to 1. Fully
+	// lit surfaces outside the fog need no shading and get no table.
+	auto shadeAt(const Context& context, const float distance, const float light) -> sampler::Shade
 	{
-		context.stencilBuffer[y * context.width + x] = value;
+		const Fog& fog = context.fog;
+
+		const float fogAmount = fog.fogEnd > fog.fogStart ? std::clamp((distance - fog.fogStart) / (fog.fogEnd - fog.fogStart), 0.0f, 1.0f) : 0.0f;
+		const size_t level = (size_t)(std::clamp(light, 0.0f, 1.0f) * (1.0f - fogAmount) * (float)(shadeLevels - 1));
+
+		if (level == shadeLevels - 1 && fogAmount == 0.0f)
+		{
+			return sampler::Shade{};
+		}
+
+		// Rounded down like the table, so a channel never goes past 255
+		const ds::ColorRGBA fogColor = ds::ColorRGBA(ds::Vec3(fog.fogColor) * fogAmount, 0);
+
+		return sampler::Shade{
+			shadeScale[level].data(),
+			ds::packColor(fogColor, context.pixelLayout),
+			(ds::PackedColor)0xFF << context.pixelLayout.a,
+			fogAmount >= 1.0f };
+	}
+
+
+	auto setSceenBufferPixel(Context& context, const size_t x, const size_t y, const glm::u8vec4& color)
+	{
+		context.targetPixels[y * context.targetPitch + x] = ds::packColor(ds::ColorRGBA(color), context.pixelLayout);
+	}
+
+
+	auto setSceenBufferPixel(Context& context, const size_t x, const size_t y, const uint32_t packedColor)
+	{
+		context.targetPixels[y * context.targetPitch + x] = packedColor;
+	}
+
+
+	auto screenRow(Context& context, const size_t y) -> uint32_t*
+	{
+		return context.targetPixels + y * context.targetPitch;
+	}
+
+
+	auto isWallPixel(const Context& context, const size_t x, const size_t y) -> bool
+	{
+		const WallSpan& span = context.wallSpans[x];
+
+		return (int)y >= span.top && (int)y < span.bottom;
+	}
+
+
+	// True when the wall of column x covers rows [top, bottom) and is not behind depth
+	auto isHiddenByWall(const Context& context, const size_t x, const int top, const int bottom, const float depth) -> bool
+	{
+		const WallSpan& span = context.wallSpans[x];
+
+		return span.depth <= depth && span.top <= top && span.bottom >= bottom;
 	}
 
 
@@ -121,24 +321,114 @@ namespace rendering
 	}
 
 
+	// Has to cover every pixel given to setDepthBufferPixel during the frame
+	auto markDepthWritten(Context& context, const PixelRect& rect)
+	{
+		if (rect.right <= rect.left || rect.bottom <= rect.top)
+		{
+			return;
+		}
+
+		PixelRect& written = context.depthWritten;
+
+		if (written.right <= written.left)
+		{
+			written = rect;
+			return;
+		}
+
+		written.left = std::min(written.left, rect.left);
+		written.top = std::min(written.top, rect.top);
+		written.right = std::max(written.right, rect.right);
+		written.bottom = std::max(written.bottom, rect.bottom);
+	}
+
+
+	// Points the passes at the pixels of the next frame. Called on the thread that owns
+	// the renderer, before the passes start.
+	auto acquireRenderTarget(Context& context)
+	{
+		if (context.useLockedTexture && context.renderer)
+		{
+			auto locked = SDL::lockTexture(context.screenTextures[1 - context.frontTexture], context.width, context.height);
+
+			if (locked.has_value())
+			{
+				context.targetPixels = locked.value().first;
+				context.targetPitch = locked.value().second;
+				context.targetLocked = true;
+				return;
+			}
+
+			// Fall back to the copy for good when the texture can not be locked
+			context.useLockedTexture = false;
+		}
+
+		context.targetPixels = context.screenBuffer.data();
+		context.targetPitch = context.width;
+		context.targetLocked = false;
+	}
+
+
+	// Hands the frame just rendered over to renderContext. Every pixel is rewritten each
+	// frame, so the pixels the passes get next need no clear.
+	auto releaseRenderTarget(Context& context)
+	{
+		if (context.targetLocked)
+		{
+			context.frontTexture = 1 - context.frontTexture;
+			SDL::unlockTexture(context.screenTextures[context.frontTexture]);
+		}
+		else
+		{
+			std::swap(context.screenBuffer, context.presentBuffer);
+		}
+
+		context.presentFromTexture = context.targetLocked;
+		context.presentWidth = context.width;
+		context.presentHeight = context.height;
+		context.targetPixels = nullptr;
+		context.targetLocked = false;
+	}
+
+
+	// Only touches the front texture, presentBuffer and the renderer, so it can run while
+	// the passes render the next frame. Presenting the same frame again uploads nothing.
 	auto renderContext(Context& context)
 	{
-		SDL::updateTexture(context.screenTexture, context.screenBuffer, context.width);
+		if (!context.renderer)
+		{
+			return;
+		}
+
+		SDL::SDLTexturePtr& texture = context.screenTextures[context.frontTexture];
 
-		SDL::renderCopy(context.renderer, context.screenTexture);
+		if (!context.presentFromTexture)
+		{
+			SDL::updateTexture(texture, context.presentBuffer, context.presentWidth, context.presentHeight);
+			context.presentFromTexture = true;
+		}
+
+		SDL::renderCopy(context.renderer, texture, context.presentWidth, context.presentHeight);
 
 		SDL::renderPresent(context.renderer);
 	}
 
 
+	// Every screen pixel is written by the walls, the floor or the sky each frame, so the
+	// screen buffer is not cleared. The wall pass rewrites every span and the depth
+	// buffer is only reset where sprites wrote it.
 	auto clearContext(Context& context)
 	{
-		std::memset(context.screenBuffer.data(), 0, context.screenBuffer.size() * sizeof(context.screenBuffer[0]));
-		std::memset(context.stencilBuffer.data(), 0, context.stencilBuffer.size() * sizeof(context.stencilBuffer[0]));
+		context.frameArena.reset();
+
+		const PixelRect written = context.depthWritten;
 
-		for (size_t i = 0; i < context.depthBuffer.size(); i++)
+		for (int y = written.top; y < written.bottom; y++)
 		{
-			context.depthBuffer[i] = 1.0f;
+			std::fill_n(&context.depthBuffer[y * context.width + written.left], written.right - written.left, 1.0f);
 		}
+
+		context.depthWritten = PixelRect{ 0, 0, 0, 0 };
 	}
 }
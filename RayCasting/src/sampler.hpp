@@ -0,0 +1,341 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#include "ds.hpp"
+#include "media.hpp"
+#include "simd.hpp"
+
+namespace sampler
+{
+	// Texture coordinates repeat every 1.0 in both directions. Filtering uses 8 bit
+	// fixed point weights. Texels and results share the screen buffer format, the
+	// four channels are blended the same way so no swizzle is needed.
+
+	constexpr int fractionBits = 16;
+	constexpr int weightBits = 8;
+
+
+	// Light and fog of a span. Every channel but alpha becomes scale[channel] plus the same
+	// channel of fog, so one table serves every layout. A span without a table is left as
+	// sampled, a span fully in the fog is fog without reading a texel.
+	struct Shade
+	{
+		const uint8_t* scale = nullptr;
+		ds::PackedColor fog = 0;
+		ds::PackedColor alphaMask = 0;
+		bool fogOnly = false;
+	};
+
+
+	// Tables and fog are built so that no channel carries into the next
+	auto applyShade(const Shade& shade, const ds::PackedColor texel) -> ds::PackedColor
+	{
+		const ds::PackedColor scaled =
+			(ds::PackedColor)shade.scale[texel & 0xFF] |
+			(ds::PackedColor)shade.scale[(texel >> 8) & 0xFF] << 8 |
+			(ds::PackedColor)shade.scale[(texel >> 16) & 0xFF] << 16 |
+			(ds::PackedColor)shade.scale[texel >> 24] << 24;
+
+		return ((scaled + shade.fog) & ~shade.alphaMask) | (texel & shade.alphaMask);
+	}
+
+
+	auto isPowerOfTwo(size_t value) -> bool
+	{
+		return value != 0 && (value & (value - 1)) == 0;
+	}
+
+	// Texel coordinates and weights of one sample
+	struct Footprint
+	{
+		size_t x0, x1;
+		size_t y0, y1;
+		int fx, fy;
+	};
+
+
+	auto bilinear(const media::ImageView& texture, const Footprint& p) -> ds::PackedColor
+	{
+		const ds::PackedColor a = texture.data[p.y0 * texture.width + p.x0];
+		const ds::PackedColor b = texture.data[p.y0 * texture.width + p.x1];
+		const ds::PackedColor c = texture.data[p.y1 * texture.width + p.x0];
+		const ds::PackedColor d = texture.data[p.y1 * texture.width + p.x1];
+
+#if defined(RAYCASTING_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+
+		// Widen to 16 bit lanes, low half holds the left texel and high half the right one
+		const __m128i ab = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128((int)a), _mm_cvtsi32_si128((int)b)), zero);
+		const __m128i cd = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128((int)c), _mm_cvtsi32_si128((int)d)), zero);
+
+		const int16_t wx0 = (int16_t)((1 << weightBits) - p.fx);
+		const int16_t wx1 = (int16_t)p.fx;
+		const __m128i weightsX = _mm_set_epi16(wx1, wx1, wx1, wx1, wx0, wx0, wx0, wx0);
+
+		__m128i productAB = _mm_mullo_epi16(ab, weightsX);
+		__m128i productCD = _mm_mullo_epi16(cd, weightsX);
+		productAB = _mm_srli_epi16(_mm_add_epi16(productAB, _mm_srli_si128(productAB, 8)), weightBits);
+		productCD = _mm_srli_epi16(_mm_add_epi16(productCD, _mm_srli_si128(productCD, 8)), weightBits);
+
+		const int16_t wy0 = (int16_t)((1 << weightBits) - p.fy);
+		const int16_t wy1 = (int16_t)p.fy;
+		const __m128i weightsY = _mm_set_epi16(wy1, wy1, wy1, wy1, wy0, wy0, wy0, wy0);
+
+		__m128i result = _mm_mullo_epi16(_mm_unpacklo_epi64(productAB, productCD), weightsY);
+		result = _mm_srli_epi16(_mm_add_epi16(result, _mm_srli_si128(result, 8)), weightBits);
+
+		return (ds::PackedColor)_mm_cvtsi128_si32(_mm_packus_epi16(result, zero));
+#else
+		const uint32_t wx0 = (1 << weightBits) - p.fx;
+		const uint32_t wy0 = (1 << weightBits) - p.fy;
+
+		ds::PackedColor packed = 0;
+
+		for (int shift = 0; shift < 32; shift += 8)
+		{
+			const uint32_t ab = (((a >> shift) & 0xFF) * wx0 + ((b >> shift) & 0xFF) * p.fx) >> weightBits;
+			const uint32_t cd = (((c >> shift) & 0xFF) * wx0 + ((d >> shift) & 0xFF) * p.fx) >> weightBits;
+			const uint32_t value = (ab * wy0 + cd * p.fy) >> weightBits;
+
+			packed |= value << shift;
+		}
+
+		return packed;
+#endif
+	}
+
+
+#if defined(RAYCASTING_SSE2)
+	// Blends four pixels at once, lane k of a, b, c and d holds the corners of pixel k and
+	// lane k of fx and fy its weights. Same arithmetic as bilinear, so both give the same
+	// colors.
+	auto bilinear4(const __m128i a, const __m128i b, const __m128i c, const __m128i d, const __m128i fx, const __m128i fy) -> __m128i
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i one = _mm_set1_epi16(1 << weightBits);
+
+		// Weights repeated over the four channels, of pixels 0 and 1 in low and of 2 and 3 in high
+		const __m128i pairsX = _mm_unpacklo_epi16(_mm_packs_epi32(fx, fx), _mm_packs_epi32(fx, fx));
+		const __m128i pairsY = _mm_unpacklo_epi16(_mm_packs_epi32(fy, fy), _mm_packs_epi32(fy, fy));
+
+		const __m128i wx1Low = _mm_unpacklo_epi32(pairsX, pairsX);
+		const __m128i wx1High = _mm_unpackhi_epi32(pairsX, pairsX);
+		const __m128i wy1Low = _mm_unpacklo_epi32(pairsY, pairsY);
+		const __m128i wy1High = _mm_unpackhi_epi32(pairsY, pairsY);
+
+		// The weights of a pair add up to 256, so the sums fit in unsigned 16 bit lanes
+		const auto blend = [](const __m128i p, const __m128i q, const __m128i w0, const __m128i w1)
+			{
+				return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(p, w0), _mm_mullo_epi16(q, w1)), weightBits);
+			};
+
+		const __m128i abLow = blend(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_sub_epi16(one, wx1Low), wx1Low);
+		const __m128i cdLow = blend(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero), _mm_sub_epi16(one, wx1Low), wx1Low);
+		const __m128i abHigh = blend(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_sub_epi16(one, wx1High), wx1High);
+		const __m128i cdHigh = blend(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero), _mm_sub_epi16(one, wx1High), wx1High);
+
+		const __m128i low = blend(abLow, cdLow, _mm_sub_epi16(one, wy1Low), wy1Low);
+		const __m128i high = blend(abHigh, cdHigh, _mm_sub_epi16(one, wy1High), wy1High);
+
+		return _mm_packus_epi16(low, high);
+	}
+#endif
+
+
+	auto nearest(const media::ImageView& texture, const Footprint& p) -> ds::PackedColor
+	{
+		return texture.data[p.y0 * texture.width + p.x0];
+	}
+
+
+	// Generic footprint for any texture size, wraps with compares instead of modulo
+	auto footprintFromUV(const media::ImageView& texture, const ds::Vec2 uv) -> Footprint
+	{
+		const float tx = (uv.x - std::floor(uv.x)) * (float)texture.width;
+		const float ty = (uv.y - std::floor(uv.y)) * (float)texture.height;
+
+		Footprint p;
+
+		p.x0 = std::min((size_t)tx, texture.width - 1);
+		p.y0 = std::min((size_t)ty, texture.height - 1);
+		p.x1 = p.x0 + 1 == texture.width ? 0 : p.x0 + 1;
+		p.y1 = p.y0 + 1 == texture.height ? 0 : p.y0 + 1;
+		p.fx = std::clamp((int)((tx - (float)p.x0) * (1 << weightBits)), 0, (1 << weightBits) - 1);
+		p.fy = std::clamp((int)((ty - (float)p.y0) * (1 << weightBits)), 0, (1 << weightBits) - 1);
+
+		return p;
+	}
+
+
+	template <bool UseFiltering>
+	auto sample(const media::ImageView& texture, const ds::Vec2 uv) -> ds::PackedColor
+	{
+		const Footprint p = footprintFromUV(texture, uv);
+
+		if constexpr (UseFiltering)
+		{
+			return bilinear(texture, p);
+		}
+		else
+		{
+			return nearest(texture, p);
+		}
+	}
+
+
+	// Samples count texels along a line starting at uv and moving uvStep per pixel, writing
+	// them to p_output every outputStride elements. Power of two textures step in 16.16
+	// fixed point and wrap with a mask.
+	template <bool UseFiltering, bool UseShade>
+	auto sampleSpan(const media::ImageView& texture, const ds::Vec2 uv, const ds::Vec2 uvStep, const size_t count, ds::PackedColor* p_output, const ptrdiff_t outputStride, const Shade& shade)
+	{
+		const auto samplePixel = [&texture, &shade](const Footprint& p) -> ds::PackedColor
+			{
+				const ds::PackedColor texel = UseFiltering ? bilinear(texture, p) : nearest(texture, p);
+
+				if constexpr (UseShade)
+				{
+					return applyShade(shade, texel);
+				}
+				else
+				{
+					return texel;
+				}
+			};
+
+		if (!isPowerOfTwo(texture.width) || !isPowerOfTwo(texture.height))
+		{
+			ds::Vec2 current = uv;
+
+			for (size_t i = 0; i < count; i++)
+			{
+				*p_output = samplePixel(footprintFromUV(texture, current));
+				p_output += outputStride;
+				current += uvStep;
+			}
+
+			return;
+		}
+
+		const auto toFixed = [](float value, size_t size) -> uint32_t
+			{
+				return (uint32_t)(int64_t)std::llround(value * (float)size * (float)(1 << fractionBits));
+			};
+
+		const uint32_t maskX = (uint32_t)texture.width - 1;
+		const uint32_t maskY = (uint32_t)texture.height - 1;
+
+		// Unsigned overflow keeps the coordinates wrapped since the sizes divide 2^32
+		uint32_t u = toFixed(uv.x - std::floor(uv.x), texture.width);
+		uint32_t v = toFixed(uv.y - std::floor(uv.y), texture.height);
+		const uint32_t du = toFixed(uvStep.x, texture.width);
+		const uint32_t dv = toFixed(uvStep.y, texture.height);
+
+		const auto footprintAt = [maskX, maskY](const uint32_t u, const uint32_t v) -> Footprint
+			{
+				Footprint p;
+
+				p.x0 = (u >> fractionBits) & maskX;
+				p.y0 = (v >> fractionBits) & maskY;
+				p.x1 = (p.x0 + 1) & maskX;
+				p.y1 = (p.y0 + 1) & maskY;
+				p.fx = (int)((u >> (fractionBits - weightBits)) & ((1 << weightBits) - 1));
+				p.fy = (int)((v >> (fractionBits - weightBits)) & ((1 << weightBits) - 1));
+
+				return p;
+			};
+
+		size_t i = 0;
+
+#if defined(RAYCASTING_SSE2)
+		// Filtered spans go four pixels at a time, the texels are fetched one by one and the
+		// blends of all four run together. Nearest spans only copy texels and stay scalar.
+		if constexpr (UseFiltering)
+		{
+			for (; i + 4 <= count; i += 4)
+			{
+				alignas(16) ds::PackedColor corners[4][4];
+				alignas(16) int32_t weights[2][4];
+
+				for (size_t k = 0; k < 4; k++)
+				{
+					const Footprint p = footprintAt(u, v);
+
+					corners[0][k] = texture.data[p.y0 * texture.width + p.x0];
+					corners[1][k] = texture.data[p.y0 * texture.width + p.x1];
+					corners[2][k] = texture.data[p.y1 * texture.width + p.x0];
+					corners[3][k] = texture.data[p.y1 * texture.width + p.x1];
+					weights[0][k] = p.fx;
+					weights[1][k] = p.fy;
+
+					u += du;
+					v += dv;
+				}
+
+				alignas(16) ds::PackedColor colors[4];
+
+				_mm_store_si128((__m128i*)colors, bilinear4(
+					_mm_load_si128((const __m128i*)corners[0]), _mm_load_si128((const __m128i*)corners[1]),
+					_mm_load_si128((const __m128i*)corners[2]), _mm_load_si128((const __m128i*)corners[3]),
+					_mm_load_si128((const __m128i*)weights[0]), _mm_load_si128((const __m128i*)weights[1])));
+
+				for (size_t k = 0; k < 4; k++)
+				{
+					if constexpr (UseShade)
+					{
+						*p_output = applyShade(shade, colors[k]);
+					}
+					else
+					{
+						*p_output = colors[k];
+					}
+
+					p_output += outputStride;
+				}
+			}
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			*p_output = samplePixel(footprintAt(u, v));
+			p_output += outputStride;
+
+			u += du;
+			v += dv;
+		}
+	}
+
+
+	auto sampleSpan(const media::ImageView& texture, const ds::Vec2 uv, const ds::Vec2 uvStep, const size_t count, ds::PackedColor* p_output, const ptrdiff_t outputStride, const bool useFiltering, const Shade& shade = Shade{})
+	{
+		if (shade.fogOnly)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				*p_output = shade.fog | shade.alphaMask;
+				p_output += outputStride;
+			}
+		}
+		else if (shade.scale != nullptr && useFiltering)
+		{
+			sampleSpan<true, true>(texture, uv, uvStep, count, p_output, outputStride, shade);
+		}
+		else if (shade.scale != nullptr)
+		{
+			sampleSpan<false, true>(texture, uv, uvStep, count, p_output, outputStride, shade);
+		}
+		else if (useFiltering)
+		{
+			sampleSpan<true, false>(texture, uv, uvStep, count, p_output, outputStride, shade);
+		}
+		else
+		{
+			sampleSpan<false, false>(texture, uv, uvStep, count, p_output, outputStride, shade);
+		}
+	}
+}
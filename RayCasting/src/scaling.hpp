@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "profiler.hpp"
+#include "rendering.hpp"
+
+namespace scaling
+{
+	// Lowers the render resolution of a context while the recent frames miss the frame
+	// budget and raises it again once they are well within it. Every change is one step on
+	// one axis. Columns go first, since the walls, the floor rows and the sky all scale with
+	// them, and come back last.
+	class ResolutionScaler
+	{
+	public:
+
+		// Milliseconds, the resolution is left alone when it is not positive
+		float frameBudget = 1000.0f / 60.0f;
+
+		// Frames slower than dropAbove * frameBudget lower the resolution, frames faster than
+		// raiseBelow * frameBudget raise it
+		float dropAbove = 0.95f;
+		float raiseBelow = 0.75f;
+
+		float minScale = 0.5f;
+		float scaleStep = 0.05f;
+
+		// Frames to average before deciding, counted from the last change so frames at the
+		// old resolution are not held against the new one
+		size_t settleFrames = 30;
+
+	private:
+
+		size_t m_stepsX = 0;
+		size_t m_stepsY = 0;
+		size_t m_lastChange = 0;
+
+		auto maxSteps() const -> size_t
+		{
+			return (size_t)std::round((1.0f - minScale) / scaleStep);
+		}
+
+		static auto scaledSize(const size_t size, const float scale) -> size_t
+		{
+			return std::max<size_t>(2, (size_t)std::round((float)size * scale));
+		}
+
+	public:
+
+		auto scaleX() const -> float
+		{
+			return 1.0f - (float)m_stepsX * scaleStep;
+		}
+
+		auto scaleY() const -> float
+		{
+			return 1.0f - (float)m_stepsY * scaleStep;
+		}
+
+		auto isFullResolution() const -> bool
+		{
+			return m_stepsX == 0 && m_stepsY == 0;
+		}
+
+		// Called after the profiler finished a frame, resizes context when the scale changed
+		auto update(const profiler::Profiler& profiler, rendering::Context& context)
+		{
+			if (!(frameBudget > 0.0f) || profiler.numFrames() < m_lastChange + settleFrames)
+			{
+				return;
+			}
+
+			const float frameTime = profiler.recentFrameTime(settleFrames);
+
+			const size_t stepsX = m_stepsX;
+			const size_t stepsY = m_stepsY;
+
+			if (frameTime > dropAbove * frameBudget)
+			{
+				if (m_stepsX < maxSteps())
+				{
+					m_stepsX++;
+				}
+				else if (m_stepsY < maxSteps())
+				{
+					m_stepsY++;
+				}
+			}
+			else if (frameTime < raiseBelow * frameBudget)
+			{
+				if (m_stepsY > 0)
+				{
+					m_stepsY--;
+				}
+				else if (m_stepsX > 0)
+				{
+					m_stepsX--;
+				}
+			}
+
+			if (m_stepsX == stepsX && m_stepsY == stepsY)
+			{
+				return;
+			}
+
+			m_lastChange = profiler.numFrames();
+
+			rendering::resizeContext(context, scaledSize(context.outputWidth, scaleX()), scaledSize(context.outputHeight, scaleY()));
+		}
+	};
+}
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <expected>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+
+#include <glm/gtc/constants.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include "ds.hpp"
+#include "camera.hpp"
+#include "wall.hpp"
+#include "spatial.hpp"
+#include "rendering.hpp"
+#include "media.hpp"
+#include "texture.hpp"
+
+
+// Content shared by the game and the benchmark, the level and its textures and the camera
+// paths used to replay a run
+namespace scene
+{
+	struct Scene
+	{
+		std::vector<wall::Wall> walls;
+		spatial::WallGrid wallGrid;
+		std::vector<rendering::Sprite> sprites;
+	};
+
+
+	// Same level as assets/levels/demo.json, built in code so the benchmark renders it
+	// without any level file
+	auto createDemoScene() -> Scene
+	{
+		Scene scene;
+
+		scene.walls =
+		{
+			wall::Wall(ds::Vec2(4.0f,  1.0f), ds::Vec2(2.0f,  1.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
+			wall::Wall(ds::Vec2(2.0f,  1.0f), ds::Vec2(2.0f,  3.0f), 1.0f, ds::Vec3(0.1f, 0.8f, 0.0f)),
+			wall::Wall(ds::Vec2(2.0f,  3.0f), ds::Vec2(-3.0f,  3.0f), 1.0f, ds::Vec3(0.1f, 0.0f, 0.8f)),
+			wall::Wall(ds::Vec2(-3.0f,  3.0f), ds::Vec2(-3.0f, -1.0f), 1.0f, ds::Vec3(0.8f, 0.0f, 0.1f)),
+			wall::Wall(ds::Vec2(-3.0f, -1.0f), ds::Vec2(0.0f, -1.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
+			wall::Wall(ds::Vec2(0.0f, -1.0f), ds::Vec2(0.0f, -2.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
+			wall::Wall(ds::Vec2(0.0f, -2.0f), ds::Vec2(-3.0f, -2.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
+			wall::Wall(ds::Vec2(-3.0f, -2.0f), ds::Vec2(-3.0f, -4.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
+			wall::Wall(ds::Vec2(-3.0f, -4.0f), ds::Vec2(1.0f, -4.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
+			wall::Wall(ds::Vec2(2.0f, -4.0f), ds::Vec2(3.0f, -4.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
+			wall::Wall(ds::Vec2(3.0f, -4.0f), ds::Vec2(3.0f, -2.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
+			wall::Wall(ds::Vec2(3.0f, -2.0f), ds::Vec2(2.0f, -2.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
+			wall::Wall(ds::Vec2(2.0f, -2.0f), ds::Vec2(2.0f,  0.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
+			wall::Wall(ds::Vec2(2.0f,  0.0f), ds::Vec2(4.0f,  0.0f), 1.0f, ds::Vec3(0.8f, 0.1f, 0.0f)),
+		};
+
+		scene.wallGrid = spatial::buildWallGrid(scene.walls);
+
+		std::vector<ds::Vec2> coinPositions =
+		{
+			{2.4f, 1.9f},
+			{0.1f, 1.5f},
+			{1.5f, 4.0f}
+		};
+
+		std::vector<ds::Vec2> treePositions =
+		{
+			{100.0f, 10.0f},
+			{17.0f, 12.0f},
+			{-10.0f, -8.0f}
+		};
+
+		for (const auto& pos : coinPositions)
+		{
+			auto coin = rendering::spriteFromTexture(2);
+			coin.size = 0.3f;
+			coin.position = pos;
+			coin.height = -0.2f;
+
+			scene.sprites.push_back(coin);
+		}
+
+		for (const auto& pos : treePositions)
+		{
+			auto tree = rendering::spriteFromTexture(3);
+
+			tree.position = pos;
+			tree.size = 2.0f;
+			tree.height = -2.0f;
+
+			scene.sprites.push_back(tree);
+		}
+
+		return scene;
+	}
+
+
+	// Builds what the sprite pass needs for textures used by sprites
+	auto prepareSpriteTexture(texture::Texture& texture)
+	{
+		if (texture.opaqueRuns.rowStart.empty())
+		{
+			texture::buildOpaqueRuns(texture);
+		}
+	}
+
+
+	auto prepareSpriteTextures(const Scene& scene, std::vector<texture::Texture>& textures)
+	{
+		for (const auto& sprite : scene.sprites)
+		{
+			prepareSpriteTexture(textures[sprite.texture]);
+		}
+	}
+
+
+	// Texture manifest, a JSON file listing the texture files relative to it. The position
+	// in the list is the TextureId.
+	//
+	//     { "textures": [ "textures/brick.bmp", "textures/mud.bmp", ... ] }
+	auto loadTextureManifest(const std::string& filename) -> std::expected<std::vector<std::string>, std::string>
+	{
+		std::ifstream fileStream(filename);
+
+		if (!fileStream.is_open())
+		{
+			return std::unexpected(std::format("Failed to open texture manifest '{}'", filename));
+		}
+
+		const nlohmann::json manifest = nlohmann::json::parse(fileStream, nullptr, false);
+
+		if (manifest.is_discarded() || !manifest.contains("textures") || !manifest["textures"].is_array())
+		{
+			return std::unexpected(std::format("Texture manifest '{}' has no 'textures' list", filename));
+		}
+
+		const std::filesystem::path directory = std::filesystem::path(filename).parent_path();
+
+		std::vector<std::string> filenames;
+
+		for (const auto& entry : manifest["textures"])
+		{
+			if (!entry.is_string())
+			{
+				return std::unexpected(std::format("Texture manifest '{}' has an entry that is not a path", filename));
+			}
+
+			filenames.push_back((directory / entry.get<std::string>()).string());
+		}
+
+		return filenames;
+	}
+
+
+	auto loadTexture(const std::string& filename) -> std::expected<texture::Texture, std::string>
+	{
+		// Prefer the cooked container when the source image is missing or not newer
+		const std::filesystem::path cookedPath = std::filesystem::path(filename).replace_extension(".rctex");
+
+		if (media::preferCooked(cookedPath, filename))
+		{
+			auto cooked = texture::loadCookedTexture(cookedPath.string());
+
+			if (cooked.has_value())
+			{
+				return cooked;
+			}
+
+			std::cout << std::format("{}, loading '{}' instead\n", cooked.error(), filename);
+		}
+
+		auto result = media::imageFromBitMapFile(filename);
+
+		if (!result.has_value())
+		{
+			return std::unexpected(result.error());
+		}
+
+		return texture::createTexture(std::move(result.value()));
+	}
+
+
+	// Input applied to the camera in one frame, between processInput and updateCamera
+	struct CameraStep
+	{
+		ds::Vec2 velocity;
+		float angularVelocity;
+		float fov;
+	};
+
+	using CameraPath = std::vector<CameraStep>;
+
+
+	auto applyCameraStep(camera::Camera& camera, const CameraStep& step)
+	{
+		camera.velocity = step.velocity;
+		camera.angularVelocity = step.angularVelocity;
+		camera.fov = step.fov;
+	}
+
+
+	auto recordCameraStep(const camera::Camera& camera) -> CameraStep
+	{
+		return CameraStep{ camera.velocity, camera.angularVelocity, camera.fov };
+	}
+
+
+	// Camera path file, one [velocity x, velocity y, angular velocity, fov] entry per frame
+	//
+	//     { "steps": [ [0.0, 0.11, 0.0, 1.5708], ... ] }
+	auto loadCameraPath(const std::string& filename) -> std::expected<CameraPath, std::string>
+	{
+		std::ifstream fileStream(filename);
+
+		if (!fileStream.is_open())
+		{
+			return std::unexpected(std::format("Failed to open camera path '{}'", filename));
+		}
+
+		const nlohmann::json file = nlohmann::json::parse(fileStream, nullptr, false);
+
+		if (file.is_discarded() || !file.contains("steps") || !file["steps"].is_array())
+		{
+			return std::unexpected(std::format("Camera path '{}' has no 'steps' list", filename));
+		}
+
+		CameraPath path;
+
+		for (const auto& entry : file["steps"])
+		{
+			if (!entry.is_array() || entry.size() != 4 || !std::all_of(entry.begin(), entry.end(), [](const auto& value) { return value.is_number(); }))
+			{
+				return std::unexpected(std::format("Camera path '{}' has a step that is not four numbers", filename));
+			}
+
+			path.push_back(CameraStep{ ds::Vec2(entry[0].get<float>(), entry[1].get<float>()), entry[2].get<float>(), entry[3].get<float>() });
+		}
+
+		return path;
+	}
+
+
+	auto writeCameraPath(const CameraPath& path, const std::string& filename) -> std::expected<void, std::string>
+	{
+		nlohmann::json steps = nlohmann::json::array();
+
+		for (const auto& step : path)
+		{
+			steps.push_back({ step.velocity.x, step.velocity.y, step.angularVelocity, step.fov });
+		}
+
+		std::ofstream fileStream(filename, std::ios::trunc);
+
+		if (!fileStream.is_open())
+		{
+			return std::unexpected(std::format("Failed to create file '{}'", filename));
+		}
+
+		fileStream << nlohmann::json{ { "steps", steps } }.dump() << '\n';
+
+		if (!fileStream.good())
+		{
+			return std::unexpected(std::format("Failed to write file '{}'", filename));
+		}
+
+		return {};
+	}
+
+
+	// Path used when none is recorded, one full turn on the spot while swaying back and
+	// forth, so every direction of the demo level is rendered
+	auto orbitCameraPath(const size_t numFrames) -> CameraPath
+	{
+		CameraPath path(numFrames);
+
+		for (size_t i = 0; i < numFrames; i++)
+		{
+			const float phase = (float)i / (float)numFrames * 2.0f * glm::pi<float>();
+
+			path[i] = CameraStep{ ds::Vec2(0.0f, 0.02f * std::cos(phase)), 2.0f * glm::pi<float>() / (float)numFrames, glm::radians(90.0f) };
+		}
+
+		return path;
+	}
+}
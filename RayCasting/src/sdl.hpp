@@ -9,6 +9,8 @@
 #include <format>
 #include <memory>
 #include <map>
+#include <optional>
+#include <utility>
 
 #include "ds.hpp"
 
@@ -89,9 +91,41 @@ namespace SDL
 	}
 
 
-	auto createTexture(SDLRendererPtr& renderer, size_t width, size_t height) -> std::expected<SDLTexturePtr, std::string>
+	// Channel layout of the 32 bit formats, the ones with padding instead of alpha included
+	auto pixelLayout(const uint32_t format) -> std::optional<ds::PixelLayout>
 	{
-        SDL_Texture* texture = SDL_CreateTexture(renderer.get(), SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, (int)width, (int)height);
+		switch (format)
+		{
+		case SDL_PIXELFORMAT_RGBA8888:
+		case SDL_PIXELFORMAT_RGBX8888:
+			return ds::rgbaLayout;
+		case SDL_PIXELFORMAT_ARGB8888:
+		case SDL_PIXELFORMAT_RGB888:
+			return ds::argbLayout;
+		case SDL_PIXELFORMAT_ABGR8888:
+		case SDL_PIXELFORMAT_BGR888:
+			return ds::abgrLayout;
+		case SDL_PIXELFORMAT_BGRA8888:
+		case SDL_PIXELFORMAT_BGRX8888:
+			return ds::bgraLayout;
+		default:
+			return std::nullopt;
+		}
+	}
+
+
+	// Format of the window surface when it is one of the 32 bit formats, RGBA8888 otherwise
+	auto nativePixelFormat(SDLWindowPtr& window) -> uint32_t
+	{
+		const uint32_t format = SDL_GetWindowPixelFormat(window.get());
+
+		return pixelLayout(format).has_value() ? format : (uint32_t)SDL_PIXELFORMAT_RGBA8888;
+	}
+
+
+	auto createTexture(SDLRendererPtr& renderer, size_t width, size_t height, uint32_t format = SDL_PIXELFORMAT_RGBA8888) -> std::expected<SDLTexturePtr, std::string>
+	{
+        SDL_Texture* texture = SDL_CreateTexture(renderer.get(), format, SDL_TEXTUREACCESS_STREAMING, (int)width, (int)height);
 
 		if (!texture)
 		{
@@ -132,15 +166,46 @@ namespace SDL
     }
 
 
-    auto updateTexture(SDLTexturePtr& texture, const std::vector<uint32_t>& pixels, size_t width)
+    // Uploads width x height pixels, rows width pixels apart, into the top left of texture
+    auto updateTexture(SDLTexturePtr& texture, const std::vector<uint32_t>& pixels, size_t width, size_t height)
     {
-        SDL_UpdateTexture(texture.get(), nullptr, pixels.data(), width * sizeof(pixels[0]));
+        const SDL_Rect rect = { 0, 0, (int)width, (int)height };
+
+        SDL_UpdateTexture(texture.get(), &rect, pixels.data(), width * sizeof(pixels[0]));
     }
 
     
-    auto renderCopy(SDLRendererPtr& renderer, SDLTexturePtr& texture)
+    // Pixels of the top left width x height of a streaming texture and the distance between
+    // its rows in pixels, valid until unlockTexture. The memory is write only, its old
+    // content is undefined.
+    auto lockTexture(SDLTexturePtr& texture, size_t width, size_t height) -> std::expected<std::pair<uint32_t*, size_t>, std::string>
+    {
+        const SDL_Rect rect = { 0, 0, (int)width, (int)height };
+
+        void* p_pixels = nullptr;
+        int pitch = 0;
+
+        if (SDL_LockTexture(texture.get(), &rect, &p_pixels, &pitch) != 0)
+        {
+            return std::unexpected(std::format("Texture lock failed: {}", SDL_GetError()));
+        }
+
+        return std::pair<uint32_t*, size_t>(static_cast<uint32_t*>(p_pixels), (size_t)pitch / sizeof(uint32_t));
+    }
+
+
+    auto unlockTexture(SDLTexturePtr& texture)
+    {
+        SDL_UnlockTexture(texture.get());
+    }
+
+
+    // Stretches the top left width x height of texture over the whole window
+    auto renderCopy(SDLRendererPtr& renderer, SDLTexturePtr& texture, size_t width, size_t height)
     {
-        SDL_RenderCopy(renderer.get(), texture.get(), nullptr, nullptr);
+        const SDL_Rect source = { 0, 0, (int)width, (int)height };
+
+        SDL_RenderCopy(renderer.get(), texture.get(), &source, nullptr);
     }
 
 
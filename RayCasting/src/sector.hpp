@@ -0,0 +1,292 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <optional>
+#include <utility>
+#include <expected>
+#include <format>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstdint>
+
+#include <nlohmann/json.hpp>
+
+#include "ds.hpp"
+#include "wall.hpp"
+#include "rendering.hpp"
+
+
+// Sector maps, the level format of the portal renderer. A map is a set of convex sectors
+// with their own floor and ceiling heights. Every edge of a sector is a wall, either solid
+// or a portal into the sector on its other side, so the renderer walks from the sector of
+// the camera to its neighbours front to back and never looks at what a column can not see.
+namespace sector
+{
+	constexpr uint32_t noNeighbor = UINT32_MAX;
+
+
+	// Edges of a sector are walls[firstEdge] up to walls[firstEdge + edgeCount], counter
+	// clockwise, so the inside is on the left of each of them. A sky sector draws the sky
+	// instead of its ceiling, and no wall is drawn between two sky sectors. Light from 0 to
+	// 1 shades the walls, floor and ceiling of the sector and the sprites standing in it.
+	struct Sector
+	{
+		float floorHeight;
+		float ceilingHeight;
+		bool hasSky;
+		float light;
+
+		uint32_t firstEdge;
+		uint32_t edgeCount;
+	};
+
+
+	// neighbors[k] is the sector on the other side of walls[k], or noNeighbor for a solid
+	// wall. Solid walls rise wall.height above the floor of their sector, capped by its
+	// ceiling.
+	struct SectorMap
+	{
+		// Texture manifest, resolved against the directory of the map
+		std::string texturesFilename;
+		std::vector<rendering::TextureId> spriteTextures;
+
+		std::vector<Sector> sectors;
+		std::vector<wall::Wall> walls;
+		std::vector<uint32_t> neighbors;
+
+		std::vector<rendering::Sprite> sprites;
+
+		rendering::Fog fog;
+	};
+
+
+	auto cross(const ds::Vec2 a, const ds::Vec2 b) -> float
+	{
+		return a.x * b.y - a.y * b.x;
+	}
+
+
+	// Sector holding position, points on an edge belong to both sides. The sectors are
+	// tested one by one, which is cheap next to rendering a frame for maps drawn by hand.
+	auto locateSector(const SectorMap& map, const ds::Vec2 position) -> std::optional<uint32_t>
+	{
+		for (uint32_t s = 0; s < (uint32_t)map.sectors.size(); s++)
+		{
+			const Sector& sector = map.sectors[s];
+
+			const bool inside = std::all_of(map.walls.begin() + sector.firstEdge, map.walls.begin() + sector.firstEdge + sector.edgeCount,
+				[&](const wall::Wall& wall) { return cross(wall.line.end - wall.line.start, position - wall.line.start) >= 0.0f; });
+
+			if (inside)
+			{
+				return s;
+			}
+		}
+
+		return std::nullopt;
+	}
+
+
+	// Reads a JSON sector map. Each sector lists the corners of a convex polygon in either
+	// order, edges shared by two sectors with the same corners become portals.
+	//
+	//     { "textures": "../textures.json",
+	//       "fog": { "start": 4, "end": 20, "color": [40, 40, 48] },
+	//       "sectors": [ { "floor": 0, "ceiling": 3, "sky": true, "wallHeight": 2, "material": 0, "light": 0.8, "vertices": [[0, 0], [4, 0], [4, 4]] } ],
+	//       "sprites": [ { "texture": 2, "position": [1, 1], "size": 0.3, "height": -0.2 } ] }
+	//
+	// wallHeight is the height of the solid walls of the sector and defaults to its ceiling,
+	// material is the texture of its walls and light defaults to 1. The fog is optional.
+	auto loadSectorMap(const std::string& filename) -> std::expected<SectorMap, std::string>
+	{
+		std::ifstream fileStream(filename);
+
+		if (!fileStream.is_open())
+		{
+			return std::unexpected(std::format("Failed to open sector map '{}'", filename));
+		}
+
+		const nlohmann::json file = nlohmann::json::parse(fileStream, nullptr, false);
+
+		if (file.is_discarded() || !file.is_object())
+		{
+			return std::unexpected(std::format("Sector map '{}' is not a JSON object", filename));
+		}
+
+		const auto isNumber = [](const nlohmann::json& value) { return value.is_number(); };
+
+		const auto isVec2 = [&](const nlohmann::json& value)
+			{
+				return value.is_array() && value.size() == 2 && std::all_of(value.begin(), value.end(), isNumber);
+			};
+
+		const auto toVec2 = [](const nlohmann::json& value)
+			{
+				return ds::Vec2(value[0].get<float>(), value[1].get<float>());
+			};
+
+		if (!file.contains("textures") || !file["textures"].is_string())
+		{
+			return std::unexpected(std::format("Sector map '{}' does not name its texture manifest", filename));
+		}
+
+		SectorMap map;
+		map.texturesFilename = (std::filesystem::path(filename).parent_path() / file["textures"].get<std::string>()).lexically_normal().string();
+
+		const nlohmann::json fog = file.value("fog", nlohmann::json::object());
+
+		const auto isColor = [](const nlohmann::json& value)
+			{
+				return value.is_array() && value.size() == 3 && std::all_of(value.begin(), value.end(), [](const nlohmann::json& channel)
+					{
+						return channel.is_number_unsigned() && channel.get<uint32_t>() <= 255;
+					});
+			};
+
+		if (!fog.is_object() || !fog.value("start", nlohmann::json(0.0f)).is_number() || !fog.value("end", nlohmann::json(0.0f)).is_number() || !isColor(fog.value("color", nlohmann::json::array({ 0u, 0u, 0u }))))
+		{
+			return std::unexpected(std::format("Sector map '{}' has an invalid fog", filename));
+		}
+
+		const nlohmann::json fogColor = fog.value("color", nlohmann::json::array({ 0u, 0u, 0u }));
+		map.fog = rendering::Fog{ fog.value("start", 0.0f), fog.value("end", 0.0f), ds::ColorRGB(fogColor[0].get<int>(), fogColor[1].get<int>(), fogColor[2].get<int>()) };
+
+		const nlohmann::json sectors = file.value("sectors", nlohmann::json());
+		const nlohmann::json sprites = file.value("sprites", nlohmann::json::array());
+
+		if (!sectors.is_array() || sectors.empty() || !sprites.is_array())
+		{
+			return std::unexpected(std::format("Sector map '{}' needs a list of sectors and a list of sprites", filename));
+		}
+
+		for (size_t s = 0; s < sectors.size(); s++)
+		{
+			const nlohmann::json& entry = sectors[s];
+
+			if (!entry.is_object() || !entry.value("floor", nlohmann::json()).is_number() || !entry.value("ceiling", nlohmann::json()).is_number() || !entry.value("sky", nlohmann::json(false)).is_boolean())
+			{
+				return std::unexpected(std::format("Sector {} of '{}' needs a floor and a ceiling height", s, filename));
+			}
+
+			const float floorHeight = entry["floor"].get<float>();
+			const float ceilingHeight = entry["ceiling"].get<float>();
+			const nlohmann::json wallHeight = entry.value("wallHeight", nlohmann::json(ceilingHeight - floorHeight));
+			const nlohmann::json vertices = entry.value("vertices", nlohmann::json());
+
+			if (!(ceilingHeight > floorHeight) || !wallHeight.is_number() || !(wallHeight.get<float>() > 0.0f))
+			{
+				return std::unexpected(std::format("Sector {} of '{}' needs its ceiling and walls above its floor", s, filename));
+			}
+
+			if (!entry.value("material", nlohmann::json(0u)).is_number_unsigned())
+			{
+				return std::unexpected(std::format("Sector {} of '{}' has an invalid material", s, filename));
+			}
+
+			const nlohmann::json light = entry.value("light", nlohmann::json(1.0f));
+
+			if (!light.is_number() || !(light.get<float>() >= 0.0f && light.get<float>() <= 1.0f))
+			{
+				return std::unexpected(std::format("Sector {} of '{}' needs a light between 0 and 1", s, filename));
+			}
+
+			if (!vertices.is_array() || vertices.size() < 3 || !std::all_of(vertices.begin(), vertices.end(), isVec2))
+			{
+				return std::unexpected(std::format("Sector {} of '{}' needs at least 3 vertices", s, filename));
+			}
+
+			std::vector<ds::Vec2> corners;
+
+			for (const auto& vertex : vertices)
+			{
+				corners.push_back(toVec2(vertex));
+			}
+
+			float area = 0.0f;
+
+			for (size_t k = 0; k < corners.size(); k++)
+			{
+				area += cross(corners[k], corners[(k + 1) % corners.size()]);
+			}
+
+			if (area < 0.0f)
+			{
+				std::reverse(corners.begin(), corners.end());
+			}
+
+			for (size_t k = 0; k < corners.size(); k++)
+			{
+				const ds::Vec2 edge = corners[(k + 1) % corners.size()] - corners[k];
+				const ds::Vec2 next = corners[(k + 2) % corners.size()] - corners[(k + 1) % corners.size()];
+
+				if (edge == ds::Vec2(0.0f) || cross(edge, next) < 0.0f)
+				{
+					return std::unexpected(std::format("Sector {} of '{}' is not convex", s, filename));
+				}
+			}
+
+			map.sectors.push_back(Sector{ floorHeight, ceilingHeight, entry.value("sky", false), light.get<float>(), (uint32_t)map.walls.size(), (uint32_t)corners.size() });
+
+			for (size_t k = 0; k < corners.size(); k++)
+			{
+				map.walls.emplace_back(corners[k], corners[(k + 1) % corners.size()], wallHeight.get<float>(), ds::ColorRGB(0), entry.value("material", 0u));
+			}
+		}
+
+		// An edge is a portal when another sector has the same edge the other way around
+		using Corner = std::pair<float, float>;
+		std::map<std::pair<Corner, Corner>, uint32_t> edgeSectors;
+
+		for (uint32_t s = 0; s < (uint32_t)map.sectors.size(); s++)
+		{
+			for (uint32_t k = map.sectors[s].firstEdge; k < map.sectors[s].firstEdge + map.sectors[s].edgeCount; k++)
+			{
+				const Line& line = map.walls[k].line;
+				edgeSectors[{ { line.start.x, line.start.y }, { line.end.x, line.end.y } }] = s;
+			}
+		}
+
+		for (const auto& wall : map.walls)
+		{
+			const auto neighbor = edgeSectors.find({ { wall.line.end.x, wall.line.end.y }, { wall.line.start.x, wall.line.start.y } });
+
+			map.neighbors.push_back(neighbor != edgeSectors.end() ? neighbor->second : noNeighbor);
+		}
+
+		for (const auto& entry : sprites)
+		{
+			if (!entry.is_object() || !entry.value("texture", nlohmann::json()).is_number_unsigned() || !isVec2(entry.value("position", nlohmann::json())))
+			{
+				return std::unexpected(std::format("Sector map '{}' has a sprite without texture and position", filename));
+			}
+
+			if (!entry.value("size", nlohmann::json(1.0f)).is_number() || !entry.value("height", nlohmann::json(0.0f)).is_number())
+			{
+				return std::unexpected(std::format("Sector map '{}' has a sprite with an invalid size or height", filename));
+			}
+
+			rendering::Sprite sprite = rendering::spriteFromTexture(entry["texture"].get<rendering::TextureId>());
+			sprite.position = toVec2(entry["position"]);
+			sprite.size = entry.value("size", 1.0f);
+			sprite.height = entry.value("height", 0.0f);
+
+			const std::optional spriteSector = locateSector(map, sprite.position);
+
+			if (spriteSector.has_value())
+			{
+				sprite.light = map.sectors[spriteSector.value()].light;
+			}
+
+			map.sprites.push_back(sprite);
+			map.spriteTextures.push_back(sprite.texture);
+		}
+
+		std::sort(map.spriteTextures.begin(), map.spriteTextures.end());
+		map.spriteTextures.erase(std::unique(map.spriteTextures.begin(), map.spriteTextures.end()), map.spriteTextures.end());
+
+		return map;
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// Instruction set selection for the hand vectorized kernels. Every kernel keeps a
+// scalar path, define RAYCASTING_NO_SIMD to force it.
+
+#if !defined(RAYCASTING_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+	#define RAYCASTING_SSE2 1
+	#include <emmintrin.h>
+#endif
+
+#include <cstddef>
+#include <new>
+
+namespace simd
+{
+	constexpr size_t cacheLineSize = 64;
+
+	// Allocator for buffers written by several threads, so tiles that start on a
+	// cache line boundary never share a line with their neighbours.
+	template <typename T>
+	struct CacheLineAllocator
+	{
+		using value_type = T;
+
+		CacheLineAllocator() = default;
+
+		template <typename U>
+		CacheLineAllocator(const CacheLineAllocator<U>&) noexcept
+		{
+		}
+
+		auto allocate(size_t count) -> T*
+		{
+			return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t{ cacheLineSize }));
+		}
+
+		auto deallocate(T* p_data, size_t) noexcept
+		{
+			::operator delete(p_data, std::align_val_t{ cacheLineSize });
+		}
+
+		template <typename U>
+		bool operator==(const CacheLineAllocator<U>&) const noexcept
+		{
+			return true;
+		}
+	};
+}
@@ -0,0 +1,419 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/geometric.hpp>
+
+#include "ds.hpp"
+#include "wall.hpp"
+#include "simd.hpp"
+
+namespace spatial
+{
+	// Number of walls tested at once against a ray. Cell lists are padded to a
+	// multiple of it with degenerate walls that never report a hit.
+	constexpr size_t wallLaneWidth = 4;
+
+
+	// Uniform grid over the wall segments of a level. Cells are stored in CSR form,
+	// the walls of cell c are wallIndices[cellStart[c] .. cellStart[c + 1]).
+	// The endpoints are copied in the same order as SoA so a cell is tested with
+	// contiguous loads.
+	struct WallGrid
+	{
+		ds::Vec2 origin = ds::Vec2(0.0f);
+		float cellSize = 1.0f;
+
+		size_t columns = 0;
+		size_t rows = 0;
+
+		std::vector<uint32_t> cellStart;
+		std::vector<uint32_t> wallIndices;
+
+		std::vector<float> startX;
+		std::vector<float> startY;
+		std::vector<float> edgeX;
+		std::vector<float> edgeY;
+		std::vector<float> edgeLength;
+	};
+
+
+	struct RayHit
+	{
+		float distance;
+
+		// Distance from wall.line.start to the hit point
+		float wallOffset;
+
+		uint32_t wallIndex;
+	};
+
+
+	// Closest hit among the walls [begin, end) of the grid, only hits nearer than
+	// inOutHit.distance are reported.
+	auto intersectCell(const WallGrid& grid, const uint32_t begin, const uint32_t end, const ds::Vec2 origin, const ds::Vec2 direction, RayHit& inOutHit) -> bool
+	{
+		bool found = false;
+
+#if defined(RAYCASTING_SSE2)
+		const __m128 originX = _mm_set1_ps(origin.x);
+		const __m128 originY = _mm_set1_ps(origin.y);
+		const __m128 directionX = _mm_set1_ps(direction.x);
+		const __m128 directionY = _mm_set1_ps(direction.y);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 parallelThreshold = _mm_set1_ps(0.001f);
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+		for (uint32_t k = begin; k < end; k += wallLaneWidth)
+		{
+			const __m128 edgeX = _mm_loadu_ps(&grid.edgeX[k]);
+			const __m128 edgeY = _mm_loadu_ps(&grid.edgeY[k]);
+			const __m128 toStartX = _mm_sub_ps(_mm_loadu_ps(&grid.startX[k]), originX);
+			const __m128 toStartY = _mm_sub_ps(_mm_loadu_ps(&grid.startY[k]), originY);
+			const __m128 length = _mm_loadu_ps(&grid.edgeLength[k]);
+
+			const __m128 denominator = _mm_sub_ps(_mm_mul_ps(directionX, edgeY), _mm_mul_ps(directionY, edgeX));
+			const __m128 tNumerator = _mm_sub_ps(_mm_mul_ps(toStartX, edgeY), _mm_mul_ps(toStartY, edgeX));
+			const __m128 uNumerator = _mm_sub_ps(_mm_mul_ps(toStartX, directionY), _mm_mul_ps(toStartY, directionX));
+
+			// Rays almost parallel to the wall are treated as misses, this also rejects the padding
+			const __m128 notParallel = _mm_cmpgt_ps(_mm_and_ps(denominator, absMask), _mm_mul_ps(length, parallelThreshold));
+			const __m128 safeDenominator = _mm_or_ps(_mm_and_ps(notParallel, denominator), _mm_andnot_ps(notParallel, one));
+
+			const __m128 t = _mm_div_ps(tNumerator, safeDenominator);
+			const __m128 u = _mm_div_ps(uNumerator, safeDenominator);
+
+			__m128 valid = _mm_and_ps(notParallel, _mm_cmpge_ps(t, zero));
+			valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(inOutHit.distance)));
+			valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+			valid = _mm_and_ps(valid, _mm_cmple_ps(u, one));
+
+			int mask = _mm_movemask_ps(valid);
+
+			if (mask == 0)
+			{
+				continue;
+			}
+
+			alignas(16) float ts[4];
+			alignas(16) float us[4];
+			_mm_store_ps(ts, t);
+			_mm_store_ps(us, u);
+
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if ((mask & (1 << lane)) && ts[lane] < inOutHit.distance)
+				{
+					inOutHit.distance = ts[lane];
+					inOutHit.wallOffset = us[lane] * grid.edgeLength[k + lane];
+					inOutHit.wallIndex = grid.wallIndices[k + lane];
+					found = true;
+				}
+			}
+		}
+#else
+		for (uint32_t k = begin; k < end; k++)
+		{
+			const float denominator = direction.x * grid.edgeY[k] - direction.y * grid.edgeX[k];
+
+			// Rays almost parallel to the wall are treated as misses, this also rejects the padding
+			if (std::abs(denominator) <= grid.edgeLength[k] * 0.001f)
+			{
+				continue;
+			}
+
+			const float toStartX = grid.startX[k] - origin.x;
+			const float toStartY = grid.startY[k] - origin.y;
+			const float t = (toStartX * grid.edgeY[k] - toStartY * grid.edgeX[k]) / denominator;
+			const float u = (toStartX * direction.y - toStartY * direction.x) / denominator;
+
+			if (t >= 0.0f && t < inOutHit.distance && u >= 0.0f && u <= 1.0f)
+			{
+				inOutHit.distance = t;
+				inOutHit.wallOffset = u * grid.edgeLength[k];
+				inOutHit.wallIndex = grid.wallIndices[k];
+				found = true;
+			}
+		}
+#endif
+
+		return found;
+	}
+
+
+	auto segmentOverlapsCell(const Line& line, const ds::Vec2 cellMin, const ds::Vec2 cellMax) -> bool
+	{
+		const ds::Vec2 segmentMin = glm::min(line.start, line.end);
+		const ds::Vec2 segmentMax = glm::max(line.start, line.end);
+
+		if (segmentMax.x < cellMin.x || segmentMin.x > cellMax.x || segmentMax.y < cellMin.y || segmentMin.y > cellMax.y)
+		{
+			return false;
+		}
+
+		// The segment overlaps the cell unless every corner lies strictly on one side of its line
+		const ds::Vec2 edge = line.end - line.start;
+		const ds::Vec2 corners[] = { cellMin, ds::Vec2(cellMax.x, cellMin.y), cellMax, ds::Vec2(cellMin.x, cellMax.y) };
+
+		int positive = 0;
+		int negative = 0;
+
+		for (const auto& corner : corners)
+		{
+			const ds::Vec2 toCorner = corner - line.start;
+			const float side = edge.x * toCorner.y - edge.y * toCorner.x;
+
+			positive += side > 0.0f;
+			negative += side < 0.0f;
+		}
+
+		return positive != 4 && negative != 4;
+	}
+
+
+	// Padding around the walls, so walls lying on a cell border are fully inside
+	constexpr float gridPadding = 0.01f;
+
+
+	// Fills the cells of a grid whose origin, cell size, columns and rows are already set.
+	// Walls are clipped to the grid, parts outside of it are not found by castRay.
+	auto fillWallGrid(WallGrid& grid, const std::vector<wall::Wall>& walls)
+	{
+		constexpr float padding = gridPadding;
+
+		const auto forEachOverlappedCell = [&](const Line& line, auto&& fn)
+			{
+				const ds::Vec2 segmentMin = (glm::min(line.start, line.end) - grid.origin) / grid.cellSize;
+				const ds::Vec2 segmentMax = (glm::max(line.start, line.end) - grid.origin) / grid.cellSize;
+
+				const size_t firstColumn = (size_t)std::clamp((int64_t)std::floor(segmentMin.x), (int64_t)0, (int64_t)grid.columns - 1);
+				const size_t lastColumn = (size_t)std::clamp((int64_t)std::floor(segmentMax.x), (int64_t)0, (int64_t)grid.columns - 1);
+				const size_t firstRow = (size_t)std::clamp((int64_t)std::floor(segmentMin.y), (int64_t)0, (int64_t)grid.rows - 1);
+				const size_t lastRow = (size_t)std::clamp((int64_t)std::floor(segmentMax.y), (int64_t)0, (int64_t)grid.rows - 1);
+
+				for (size_t row = firstRow; row <= lastRow; row++)
+				{
+					for (size_t column = firstColumn; column <= lastColumn; column++)
+					{
+						const ds::Vec2 cellMin = grid.origin + ds::Vec2((float)column, (float)row) * grid.cellSize - ds::Vec2(padding);
+						const ds::Vec2 cellMax = cellMin + ds::Vec2(grid.cellSize + 2.0f * padding);
+
+						if (segmentOverlapsCell(line, cellMin, cellMax))
+						{
+							fn(row * grid.columns + column);
+						}
+					}
+				}
+			};
+
+		// Two passes, count walls per cell then scatter the indices
+		std::vector<uint32_t> cellCount(grid.columns * grid.rows, 0);
+
+		for (const auto& wall : walls)
+		{
+			forEachOverlappedCell(wall.line, [&](size_t cell) { cellCount[cell] += 1; });
+		}
+
+		for (auto& count : cellCount)
+		{
+			count = (uint32_t)(((count + wallLaneWidth - 1) / wallLaneWidth) * wallLaneWidth);
+		}
+
+		grid.cellStart.resize(cellCount.size() + 1);
+		grid.cellStart[0] = 0;
+
+		for (size_t i = 0; i < cellCount.size(); i++)
+		{
+			grid.cellStart[i + 1] = grid.cellStart[i] + cellCount[i];
+		}
+
+		const size_t numEntries = grid.cellStart.back();
+
+		// Padding entries keep a zero length edge
+		grid.wallIndices.assign(numEntries, 0);
+		grid.startX.assign(numEntries, 0.0f);
+		grid.startY.assign(numEntries, 0.0f);
+		grid.edgeX.assign(numEntries, 0.0f);
+		grid.edgeY.assign(numEntries, 0.0f);
+		grid.edgeLength.assign(numEntries, 0.0f);
+
+		std::vector<uint32_t> cellFill(grid.cellStart.begin(), grid.cellStart.end() - 1);
+
+		for (uint32_t i = 0; i < walls.size(); i++)
+		{
+			const Line& line = walls[i].line;
+
+			forEachOverlappedCell(line, [&](size_t cell)
+				{
+					const uint32_t k = cellFill[cell]++;
+
+					grid.wallIndices[k] = i;
+					grid.startX[k] = line.start.x;
+					grid.startY[k] = line.start.y;
+					grid.edgeX[k] = line.end.x - line.start.x;
+					grid.edgeY[k] = line.end.y - line.start.y;
+					grid.edgeLength[k] = glm::distance(line.start, line.end);
+				});
+		}
+	}
+
+
+	// Grid over the bounds of the walls
+	auto buildWallGrid(const std::vector<wall::Wall>& walls) -> WallGrid
+	{
+		WallGrid grid;
+
+		if (walls.empty())
+		{
+			grid.columns = 1;
+			grid.rows = 1;
+			grid.cellStart = { 0, 0 };
+			return grid;
+		}
+
+		ds::Vec2 boundsMin = walls[0].line.start;
+		ds::Vec2 boundsMax = walls[0].line.start;
+		float totalLength = 0.0f;
+
+		for (const auto& wall : walls)
+		{
+			boundsMin = glm::min(boundsMin, glm::min(wall.line.start, wall.line.end));
+			boundsMax = glm::max(boundsMax, glm::max(wall.line.start, wall.line.end));
+			totalLength += glm::distance(wall.line.start, wall.line.end);
+		}
+
+		boundsMin -= ds::Vec2(gridPadding);
+		boundsMax += ds::Vec2(gridPadding);
+
+		const ds::Vec2 extent = boundsMax - boundsMin;
+
+		// Cells about the size of an average wall, capped at four cells per wall
+		const float averageLength = totalLength / (float)walls.size();
+		const float minCellSize = std::sqrt(extent.x * extent.y / (4.0f * (float)walls.size()));
+
+		grid.origin = boundsMin;
+		grid.cellSize = std::max({ averageLength, minCellSize, gridPadding });
+		grid.columns = std::max<size_t>(1, (size_t)std::ceil(extent.x / grid.cellSize));
+		grid.rows = std::max<size_t>(1, (size_t)std::ceil(extent.y / grid.cellSize));
+
+		fillWallGrid(grid, walls);
+
+		return grid;
+	}
+
+
+	// Walks the cells crossed by the ray with a DDA and returns the closest wall hit.
+	// The walk stops at the first cell that contains a hit closer than its exit point.
+	auto castRay(const WallGrid& grid, const ds::Vec2 origin, const ds::Vec2 direction, const float maxDistance) -> std::optional<RayHit>
+	{
+		constexpr float infinity = std::numeric_limits<float>::infinity();
+
+		// Clip the ray against the grid bounds
+		const ds::Vec2 boundsMin = grid.origin;
+		const ds::Vec2 boundsMax = grid.origin + ds::Vec2((float)grid.columns, (float)grid.rows) * grid.cellSize;
+
+		float tEnter = 0.0f;
+		float tLeave = maxDistance;
+
+		for (int axis = 0; axis < 2; axis++)
+		{
+			if (direction[axis] == 0.0f)
+			{
+				if (origin[axis] < boundsMin[axis] || origin[axis] > boundsMax[axis])
+				{
+					return std::nullopt;
+				}
+
+				continue;
+			}
+
+			const float inverse = 1.0f / direction[axis];
+			float t0 = (boundsMin[axis] - origin[axis]) * inverse;
+			float t1 = (boundsMax[axis] - origin[axis]) * inverse;
+
+			if (t0 > t1)
+			{
+				std::swap(t0, t1);
+			}
+
+			tEnter = std::max(tEnter, t0);
+			tLeave = std::min(tLeave, t1);
+		}
+
+		if (tEnter > tLeave)
+		{
+			return std::nullopt;
+		}
+
+		const ds::Vec2 entry = (origin + direction * tEnter - grid.origin) / grid.cellSize;
+
+		int64_t column = std::clamp((int64_t)std::floor(entry.x), (int64_t)0, (int64_t)grid.columns - 1);
+		int64_t row = std::clamp((int64_t)std::floor(entry.y), (int64_t)0, (int64_t)grid.rows - 1);
+
+		const int64_t stepColumn = direction.x > 0.0f ? 1 : -1;
+		const int64_t stepRow = direction.y > 0.0f ? 1 : -1;
+
+		const float tDeltaX = direction.x != 0.0f ? grid.cellSize / std::abs(direction.x) : infinity;
+		const float tDeltaY = direction.y != 0.0f ? grid.cellSize / std::abs(direction.y) : infinity;
+
+		const auto nextBoundary = [&](int64_t cell, int64_t step, int axis) -> float
+			{
+				if (direction[axis] == 0.0f)
+				{
+					return infinity;
+				}
+
+				const float boundary = grid.origin[axis] + (float)(cell + (step > 0 ? 1 : 0)) * grid.cellSize;
+
+				return (boundary - origin[axis]) / direction[axis];
+			};
+
+		float tMaxX = nextBoundary(column, stepColumn, 0);
+		float tMaxY = nextBoundary(row, stepRow, 1);
+
+		RayHit closest{ maxDistance, 0.0f, 0 };
+		bool found = false;
+
+		while (true)
+		{
+			const size_t cell = (size_t)row * grid.columns + (size_t)column;
+
+			found |= intersectCell(grid, grid.cellStart[cell], grid.cellStart[cell + 1], origin, direction, closest);
+
+			const float tCellExit = std::min(tMaxX, tMaxY);
+
+			if ((found && closest.distance <= tCellExit) || tCellExit > tLeave)
+			{
+				break;
+			}
+
+			if (tMaxX < tMaxY)
+			{
+				column += stepColumn;
+				tMaxX += tDeltaX;
+			}
+			else
+			{
+				row += stepRow;
+				tMaxY += tDeltaY;
+			}
+
+			if (column < 0 || row < 0 || column >= (int64_t)grid.columns || row >= (int64_t)grid.rows)
+			{
+				break;
+			}
+		}
+
+		if (!found)
+		{
+			return std::nullopt;
+		}
+
+		return closest;
+	}
+}
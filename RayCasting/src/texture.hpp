@@ -0,0 +1,402 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <expected>
+#include <format>
+#include <fstream>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+
+#include "ds.hpp"
+#include "media.hpp"
+
+namespace texture
+{
+	// Texels of this color are transparent in sprite textures
+	constexpr ds::PackedColor colorKey = ds::packColor(0, 255, 255, 255);
+
+
+	// Opaque texels of every row of the full size level as [start, end) runs, so sprites
+	// skip their transparent parts without testing each texel
+	struct OpaqueRuns
+	{
+		struct Run
+		{
+			uint32_t start;
+			uint32_t end;
+		};
+
+		// Runs of row r are runs[rowStart[r]] up to runs[rowStart[r + 1]]
+		std::vector<uint32_t> rowStart;
+		std::vector<Run> runs;
+	};
+
+
+	// Mip chain of one texture. The levels are views into storage, which owns either
+	// the images decoded at load time or the mapped cooked file.
+	struct Texture
+	{
+		std::vector<media::ImageView> mipmaps;
+
+		size_t width;
+		size_t height;
+
+		std::shared_ptr<const void> storage;
+
+		// Only built for textures used by sprites, see buildOpaqueRuns
+		OpaqueRuns opaqueRuns;
+
+		// Layout of the texels, decoded images are RGBA8888 and cooked files keep the
+		// layout they were cooked for
+		ds::PixelLayout layout = ds::rgbaLayout;
+	};
+
+
+	// Halves the image with a box filter. Odd sizes are handled by letting the boxes of
+	// neighbouring texels overlap, so the last row and column are not dropped.
+	auto minifyImage(const media::ImageView& image) -> media::Image
+	{
+		auto result = media::Image(std::max<size_t>(1, image.width / 2), std::max<size_t>(1, image.height / 2));
+
+		const auto sourceRange = [](size_t index, size_t sourceSize, size_t resultSize) -> std::pair<size_t, size_t>
+			{
+				const size_t first = (index * sourceSize) / resultSize;
+				const size_t last = ((index + 1) * sourceSize + resultSize - 1) / resultSize;
+
+				return { first, std::max(last, first + 1) };
+			};
+
+		for (size_t i = 0; i < result.height; i++)
+		{
+			const auto [firstRow, lastRow] = sourceRange(i, image.height, result.height);
+
+			for (size_t j = 0; j < result.width; j++)
+			{
+				const auto [firstColumn, lastColumn] = sourceRange(j, image.width, result.width);
+
+				ds::ColorRGBA sum(0);
+
+				for (size_t _i = firstRow; _i < lastRow; _i++)
+				{
+					for (size_t _j = firstColumn; _j < lastColumn; _j++)
+					{
+						sum += ds::unpackColor(image.data[_i * image.width + _j]);
+					}
+				}
+
+				const int count = (int)((lastRow - firstRow) * (lastColumn - firstColumn));
+
+				result.data[i*result.width + j] = ds::packColor(sum / count);
+			}
+		}
+
+		return result;
+	}
+
+
+	// Builds the full mip chain down to 1x1
+	auto createTexture(media::Image&& image) -> Texture
+	{
+		auto p_images = std::make_shared<std::vector<media::Image>>();
+		p_images->push_back(std::move(image));
+
+		while (p_images->back().width > 1 || p_images->back().height > 1)
+		{
+			p_images->push_back(minifyImage(p_images->back()));
+		}
+
+		std::vector<media::ImageView> mipmaps(p_images->begin(), p_images->end());
+
+		const size_t width = mipmaps[0].width;
+		const size_t height = mipmaps[0].height;
+
+		return Texture{ std::move(mipmaps), width, height, std::move(p_images) };
+	}
+
+
+	auto buildOpaqueRuns(Texture& texture)
+	{
+		const media::ImageView& image = texture.mipmaps[0];
+		OpaqueRuns& opaqueRuns = texture.opaqueRuns;
+
+		const ds::PackedColor key = ds::convertColor(colorKey, texture.layout);
+
+		opaqueRuns.rowStart.clear();
+		opaqueRuns.runs.clear();
+
+		for (size_t i = 0; i < image.height; i++)
+		{
+			opaqueRuns.rowStart.push_back((uint32_t)opaqueRuns.runs.size());
+
+			const ds::PackedColor* p_row = image.data + i * image.width;
+			size_t j = 0;
+
+			while (j < image.width)
+			{
+				if (p_row[j] == key)
+				{
+					j++;
+					continue;
+				}
+
+				const size_t start = j;
+
+				while (j < image.width && p_row[j] != key)
+				{
+					j++;
+				}
+
+				opaqueRuns.runs.push_back(OpaqueRuns::Run{ (uint32_t)start, (uint32_t)j });
+			}
+		}
+
+		opaqueRuns.rowStart.push_back((uint32_t)opaqueRuns.runs.size());
+	}
+
+
+	// Moves the channels of every level to the screen layout, so the passes copy texels
+	// unchanged. Converted levels are owned by the texture, a mapped cooked file is only
+	// kept when it was cooked for this layout. Opaque runs only depend on positions and
+	// stay valid.
+	auto convertTexture(Texture& texture, const ds::PixelLayout& layout)
+	{
+		if (layout == texture.layout)
+		{
+			return;
+		}
+
+		auto p_images = std::make_shared<std::vector<media::Image>>();
+
+		for (const auto& level : texture.mipmaps)
+		{
+			media::Image& image = p_images->emplace_back(level.width, level.height);
+
+			std::transform(level.data, level.data + level.width * level.height, image.data.begin(),
+				[&](const ds::PackedColor color) { return ds::convertColor(color, texture.layout, layout); });
+		}
+
+		texture.mipmaps.assign(p_images->begin(), p_images->end());
+		texture.storage = std::move(p_images);
+		texture.layout = layout;
+	}
+
+
+	// Picks the mip level whose texels are closest to one screen pixel out of a chain of
+	// levelCount. texelsPerPixel is the footprint of one pixel measured in texels of the full
+	// size level.
+	auto selectMipmapLevel(const size_t levelCount, const float texelsPerPixel) -> size_t
+	{
+		if (!(texelsPerPixel > 1.0f))
+		{
+			return 0;
+		}
+
+		const size_t lastLevel = levelCount - 1;
+
+		if (!std::isfinite(texelsPerPixel))
+		{
+			return lastLevel;
+		}
+
+		return std::min((size_t)std::log2(texelsPerPixel), lastLevel);
+	}
+
+
+	auto selectMipmapLevel(const Texture& texture, const float texelsPerPixel) -> size_t
+	{
+		return selectMipmapLevel(texture.mipmaps.size(), texelsPerPixel);
+	}
+
+
+	// Mip levels of every texture in one flat table, each chain contiguous. Walls name their
+	// texture by material, an index into materials, so the wall pass reaches the texels of
+	// a column through two flat tables instead of the texture and its vector of levels.
+	// The levels are views into the storage of the textures, which the atlas shares, so
+	// mapped cooked files are used in place.
+	struct TextureAtlas
+	{
+		struct Material
+		{
+			uint32_t firstLevel;
+			uint32_t levelCount;
+			float width;
+		};
+
+		std::vector<Material> materials;
+		std::vector<media::ImageView> levels;
+
+		std::vector<std::shared_ptr<const void>> storage;
+	};
+
+
+	// Builds the level table of the atlas from the textures without copying texels. Runs
+	// after convertTexture, which is the only step that replaces the levels.
+	auto packTextures(const std::vector<Texture>& textures) -> TextureAtlas
+	{
+		TextureAtlas atlas;
+
+		for (const auto& texture : textures)
+		{
+			atlas.materials.push_back(TextureAtlas::Material{ (uint32_t)atlas.levels.size(), (uint32_t)texture.mipmaps.size(), (float)texture.width });
+			atlas.levels.insert(atlas.levels.end(), texture.mipmaps.begin(), texture.mipmaps.end());
+			atlas.storage.push_back(texture.storage);
+		}
+
+		return atlas;
+	}
+
+
+	// Cooked texture container, written offline by AssetCooker. A header and a table
+	// with one entry per mip level are followed by the levels, already packed in the
+	// screen buffer layout stored in the header and aligned to a cache line, so the file
+	// is used in place when the window has that layout.
+	constexpr char cookedMagic[4] = { 'R', 'C', 'T', 'X' };
+	constexpr uint32_t cookedVersion = 2;
+	constexpr size_t cookedAlignment = 64;
+	constexpr uint32_t maxCookedLevels = 32;
+
+	struct CookedHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t width;
+		uint32_t height;
+		uint32_t levelCount;
+
+		// Bit offsets of the channels, r, g, b and a from the low byte up
+		uint8_t layout[4];
+	};
+
+	struct CookedLevel
+	{
+		uint32_t width;
+		uint32_t height;
+		uint64_t offset;
+	};
+
+	static_assert(sizeof(CookedHeader) == 24 && sizeof(CookedLevel) == 16, "Cooked layout must not depend on the compiler");
+
+
+	// Writes the levels in the layout of the texture, see convertTexture
+	auto writeCookedTexture(const Texture& texture, const std::string& filename) -> std::expected<void, std::string>
+	{
+		std::vector<CookedLevel> levels;
+
+		uint64_t offset = sizeof(CookedHeader) + texture.mipmaps.size() * sizeof(CookedLevel);
+
+		for (const auto& level : texture.mipmaps)
+		{
+			offset = (offset + cookedAlignment - 1) & ~(uint64_t)(cookedAlignment - 1);
+			levels.push_back(CookedLevel{ (uint32_t)level.width, (uint32_t)level.height, offset });
+			offset += level.width * level.height * sizeof(ds::PackedColor);
+		}
+
+		CookedHeader header{};
+		std::memcpy(header.magic, cookedMagic, sizeof(cookedMagic));
+		header.version = cookedVersion;
+		header.width = (uint32_t)texture.width;
+		header.height = (uint32_t)texture.height;
+		header.levelCount = (uint32_t)levels.size();
+		header.layout[0] = (uint8_t)texture.layout.r;
+		header.layout[1] = (uint8_t)texture.layout.g;
+		header.layout[2] = (uint8_t)texture.layout.b;
+		header.layout[3] = (uint8_t)texture.layout.a;
+
+		std::ofstream fileStream(filename, std::ios::binary | std::ios::trunc);
+
+		if (!fileStream.is_open())
+		{
+			return std::unexpected(std::format("Failed to create file '{}'", filename));
+		}
+
+		fileStream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		fileStream.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(CookedLevel));
+
+		const char padding[cookedAlignment] = {};
+
+		for (size_t i = 0; i < levels.size(); i++)
+		{
+			fileStream.write(padding, levels[i].offset - (uint64_t)fileStream.tellp());
+			fileStream.write(reinterpret_cast<const char*>(texture.mipmaps[i].data), levels[i].width * levels[i].height * sizeof(ds::PackedColor));
+		}
+
+		if (!fileStream.good())
+		{
+			return std::unexpected(std::format("Failed to write file '{}'", filename));
+		}
+
+		return {};
+	}
+
+
+	// Maps a cooked texture, the levels point straight into the mapping
+	auto loadCookedTexture(const std::string& filename) -> std::expected<Texture, std::string>
+	{
+		auto mapped = media::MappedFile::open(filename);
+
+		if (!mapped.has_value())
+		{
+			return std::unexpected(mapped.error());
+		}
+
+		auto p_file = std::make_shared<media::MappedFile>(std::move(mapped.value()));
+
+		const std::byte* p_data = p_file->data();
+		const size_t fileSize = p_file->size();
+
+		CookedHeader header;
+
+		if (fileSize < sizeof(header))
+		{
+			return std::unexpected(std::format("Cooked texture '{}' is truncated", filename));
+		}
+
+		std::memcpy(&header, p_data, sizeof(header));
+
+		if (std::memcmp(header.magic, cookedMagic, sizeof(cookedMagic)) != 0 || header.version != cookedVersion)
+		{
+			return std::unexpected(std::format("File '{}' is not a cooked texture of version {}", filename, cookedVersion));
+		}
+
+		const ds::PixelLayout layout = { header.layout[0], header.layout[1], header.layout[2], header.layout[3] };
+
+		if (!ds::isByteLayout(layout))
+		{
+			return std::unexpected(std::format("Invalid pixel layout in cooked texture '{}'", filename));
+		}
+
+		if (header.levelCount == 0 || header.levelCount > maxCookedLevels || fileSize < sizeof(header) + header.levelCount * sizeof(CookedLevel))
+		{
+			return std::unexpected(std::format("Invalid level table in cooked texture '{}'", filename));
+		}
+
+		std::vector<media::ImageView> mipmaps;
+
+		for (uint32_t i = 0; i < header.levelCount; i++)
+		{
+			CookedLevel level;
+			std::memcpy(&level, p_data + sizeof(header) + i * sizeof(CookedLevel), sizeof(level));
+
+			const uint64_t bytes = (uint64_t)level.width * level.height * sizeof(ds::PackedColor);
+
+			if (level.width == 0 || level.height == 0 || level.offset % alignof(ds::PackedColor) != 0 || level.offset > fileSize || bytes > fileSize - level.offset)
+			{
+				return std::unexpected(std::format("Level {} of cooked texture '{}' is out of bounds", i, filename));
+			}
+
+			mipmaps.emplace_back(reinterpret_cast<const ds::PackedColor*>(p_data + level.offset), level.width, level.height);
+		}
+
+		if (mipmaps[0].width != header.width || mipmaps[0].height != header.height)
+		{
+			return std::unexpected(std::format("First level of cooked texture '{}' does not match its size", filename));
+		}
+
+		return Texture{ std::move(mipmaps), header.width, header.height, std::move(p_file), OpaqueRuns{}, layout };
+	}
+}
@@ -0,0 +1,404 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <chrono>
+#include <cstdint>
+
+namespace threading
+{
+	// A batch of tiles submitted by one dispatch call. Owned by the caller until every
+	// tile has been executed.
+	struct Job
+	{
+		void (*invoke)(void* fn, size_t start, size_t end);
+		void* fn;
+		std::atomic<size_t> remaining;
+	};
+
+	struct Task
+	{
+		Job* job;
+		size_t start;
+		size_t end;
+	};
+
+
+	// Double ended queue on a ring buffer. Storage only grows when a job submits more
+	// tiles than ever before, so steady state frames do not allocate.
+	class TaskQueue
+	{
+	private:
+
+		std::vector<Task> m_buffer = std::vector<Task>(64);
+		size_t m_head = 0;
+		size_t m_size = 0;
+
+		auto grow()
+		{
+			std::vector<Task> buffer(m_buffer.size() * 2);
+
+			for (size_t i = 0; i < m_size; i++)
+			{
+				buffer[i] = m_buffer[(m_head + i) & (m_buffer.size() - 1)];
+			}
+
+			m_buffer = std::move(buffer);
+			m_head = 0;
+		}
+
+	public:
+
+		auto empty() const -> bool
+		{
+			return m_size == 0;
+		}
+
+		auto pushBack(const Task& task)
+		{
+			if (m_size == m_buffer.size())
+			{
+				grow();
+			}
+
+			m_buffer[(m_head + m_size) & (m_buffer.size() - 1)] = task;
+			m_size += 1;
+		}
+
+		auto popBack() -> Task
+		{
+			m_size -= 1;
+			return m_buffer[(m_head + m_size) & (m_buffer.size() - 1)];
+		}
+
+		auto popFront() -> Task
+		{
+			const Task task = m_buffer[m_head];
+			m_head = (m_head + 1) & (m_buffer.size() - 1);
+			m_size -= 1;
+			return task;
+		}
+	};
+
+
+	class ThreadPool;
+
+	// Work started with ThreadPool::dispatch
+	class JobHandle
+	{
+	private:
+
+		friend class ThreadPool;
+
+		Job m_job{};
+
+	public:
+
+		JobHandle() = default;
+
+		JobHandle(const JobHandle&) = delete;
+		JobHandle& operator=(const JobHandle&) = delete;
+
+		auto isDone() const -> bool
+		{
+			return m_job.remaining.load(std::memory_order_acquire) == 0;
+		}
+	};
+
+
+	// Long lived pool with one deque per worker. Workers pop their own tasks from the
+	// back and steal from the front of the other deques when they run dry. The thread
+	// waiting on a job takes part in the work until it is done, so nested calls
+	// from inside a task are safe.
+	class ThreadPool
+	{
+	private:
+
+		struct Worker
+		{
+			std::mutex mutex;
+			TaskQueue tasks;
+
+			// Time spent running tasks, read by the profiler to get busy and idle time
+			std::atomic<uint64_t> busyNanoseconds = 0;
+		};
+
+		// Slot 0 is shared by every thread that is not a worker of this pool
+		std::vector<std::unique_ptr<Worker>> m_workers;
+		std::vector<std::thread> m_threads;
+
+		// Workers sleep on m_wakeUp until tasks are pending, threads in wait sleep on
+		// m_waitWakeUp until tasks are pending or a job finished
+		std::mutex m_sleepMutex;
+		std::condition_variable m_wakeUp;
+		std::condition_variable m_waitWakeUp;
+		std::atomic<size_t> m_pendingTasks = 0;
+		bool m_stop = false;
+
+		static inline thread_local const ThreadPool* t_pool = nullptr;
+		static inline thread_local size_t t_workerIndex = 0;
+
+		// Tasks running on this thread and time they spent waiting on nested jobs, which is
+		// not counted as busy time of the outer task since the nested tasks count themselves
+		static inline thread_local size_t t_taskDepth = 0;
+		static inline thread_local uint64_t t_nestedWaitNanoseconds = 0;
+
+		auto currentWorkerIndex() const -> size_t
+		{
+			return t_pool == this ? t_workerIndex : 0;
+		}
+
+		auto popTask(size_t workerIndex, Task& outTask) -> bool
+		{
+			const size_t numWorkers = m_workers.size();
+
+			{
+				Worker& own = *m_workers[workerIndex];
+				std::lock_guard lock(own.mutex);
+
+				if (!own.tasks.empty())
+				{
+					outTask = own.tasks.popBack();
+					m_pendingTasks.fetch_sub(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+
+			for (size_t k = 1; k < numWorkers; k++)
+			{
+				Worker& victim = *m_workers[(workerIndex + k) % numWorkers];
+				std::lock_guard lock(victim.mutex);
+
+				if (!victim.tasks.empty())
+				{
+					outTask = victim.tasks.popFront();
+					m_pendingTasks.fetch_sub(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		auto runTask(size_t workerIndex, const Task& task)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			const uint64_t nestedWaitBefore = t_nestedWaitNanoseconds;
+
+			t_taskDepth += 1;
+			task.job->invoke(task.job->fn, task.start, task.end);
+			t_taskDepth -= 1;
+
+			const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+			const uint64_t nestedWait = t_nestedWaitNanoseconds - nestedWaitBefore;
+			t_nestedWaitNanoseconds = nestedWaitBefore;
+			m_workers[workerIndex]->busyNanoseconds.fetch_add((uint64_t)elapsed.count() - std::min((uint64_t)elapsed.count(), nestedWait), std::memory_order_relaxed);
+
+			if (task.job->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				// Taking the lock orders the notification after the check of a waiter about
+				// to sleep
+				{
+					std::lock_guard lock(m_sleepMutex);
+				}
+
+				m_waitWakeUp.notify_all();
+			}
+		}
+
+		auto workerLoop(size_t workerIndex)
+		{
+			t_pool = this;
+			t_workerIndex = workerIndex;
+
+			Task task{};
+
+			while (true)
+			{
+				if (popTask(workerIndex, task))
+				{
+					runTask(workerIndex, task);
+					continue;
+				}
+
+				std::unique_lock lock(m_sleepMutex);
+				m_wakeUp.wait(lock, [this] { return m_stop || m_pendingTasks.load() > 0; });
+
+				if (m_stop && m_pendingTasks.load() == 0)
+				{
+					return;
+				}
+			}
+		}
+
+	public:
+
+		explicit ThreadPool(size_t numThreads = std::thread::hardware_concurrency())
+		{
+			numThreads = std::max<size_t>(numThreads, 1);
+
+			for (size_t i = 0; i < numThreads; i++)
+			{
+				m_workers.push_back(std::make_unique<Worker>());
+			}
+
+			// The calling thread counts as one of the threads, it works while it waits
+			for (size_t i = 1; i < numThreads; i++)
+			{
+				m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+			}
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard lock(m_sleepMutex);
+				m_stop = true;
+			}
+
+			m_wakeUp.notify_all();
+
+			for (auto& thread : m_threads)
+			{
+				thread.join();
+			}
+		}
+
+		auto numThreads() const -> size_t
+		{
+			return m_workers.size();
+		}
+
+		// Total time thread slot index spent running tasks since the pool started. Slot 0
+		// is shared by every thread that is not a worker.
+		auto busyTime(size_t index) const -> std::chrono::nanoseconds
+		{
+			return std::chrono::nanoseconds(m_workers[index]->busyNanoseconds.load(std::memory_order_relaxed));
+		}
+
+		// Starts running fn(start, end) on tiles of grainSize elements and returns right
+		// away. The handle and fn must stay alive until wait is called on the handle.
+		template <typename Fn>
+		auto dispatch(JobHandle& handle, size_t dataSize, size_t grainSize, Fn& fn)
+		{
+			if (dataSize == 0)
+			{
+				return;
+			}
+
+			grainSize = std::max<size_t>(grainSize, 1);
+
+			const size_t numTasks = (dataSize + grainSize - 1) / grainSize;
+
+			Job& job = handle.m_job;
+			job.invoke = [](void* p_fn, size_t start, size_t end)
+				{
+					(*static_cast<std::remove_reference_t<Fn>*>(p_fn))(start, end);
+				};
+			job.fn = const_cast<void*>(static_cast<const void*>(&fn));
+			job.remaining.store(numTasks);
+
+			const size_t self = currentWorkerIndex();
+			const size_t numWorkers = m_workers.size();
+
+			// Counted before they are published, a worker may run and uncount them as soon as
+			// they are in a deque
+			{
+				std::lock_guard lock(m_sleepMutex);
+				m_pendingTasks.fetch_add(numTasks);
+			}
+
+			// Spread the tiles round robin so every worker starts with local work
+			for (size_t w = 0; w < numWorkers; w++)
+			{
+				Worker& worker = *m_workers[(self + w) % numWorkers];
+				std::lock_guard lock(worker.mutex);
+
+				for (size_t t = w; t < numTasks; t += numWorkers)
+				{
+					const size_t start = t * grainSize;
+					const size_t end = std::min(start + grainSize, dataSize);
+					worker.tasks.pushBack(Task{ &job, start, end });
+				}
+			}
+
+			m_wakeUp.notify_all();
+			m_waitWakeUp.notify_all();
+		}
+
+		// Works on pending tasks until every tile of the handle has been processed, and sleeps
+		// while the last ones run on other threads
+		auto wait(JobHandle& handle)
+		{
+			const size_t self = currentWorkerIndex();
+			const auto start = std::chrono::steady_clock::now();
+
+			const auto isDone = [&handle]() { return handle.m_job.remaining.load(std::memory_order_acquire) == 0; };
+
+			Task task{};
+
+			while (!isDone())
+			{
+				if (popTask(self, task))
+				{
+					runTask(self, task);
+					continue;
+				}
+
+				std::unique_lock lock(m_sleepMutex);
+				m_waitWakeUp.wait(lock, [&] { return isDone() || m_pendingTasks.load() > 0; });
+			}
+
+			if (t_taskDepth > 0)
+			{
+				t_nestedWaitNanoseconds += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			}
+		}
+
+		// Splits [0, dataSize) in tiles of grainSize elements and runs fn(start, end) on
+		// each of them. Returns once every tile has been processed.
+		template <typename Fn>
+		auto parallelFor(size_t dataSize, size_t grainSize, Fn&& fn)
+		{
+			if (dataSize == 0)
+			{
+				return;
+			}
+
+			grainSize = std::max<size_t>(grainSize, 1);
+
+			const size_t numTasks = (dataSize + grainSize - 1) / grainSize;
+
+			if (numTasks == 1 || m_workers.size() == 1)
+			{
+				// Inside a task the time already counts as busy time of that task
+				if (t_taskDepth > 0)
+				{
+					fn(0, dataSize);
+					return;
+				}
+
+				const auto start = std::chrono::steady_clock::now();
+
+				fn(0, dataSize);
+
+				const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+				m_workers[currentWorkerIndex()]->busyNanoseconds.fetch_add((uint64_t)elapsed.count(), std::memory_order_relaxed);
+				return;
+			}
+
+			JobHandle handle;
+			dispatch(handle, dataSize, grainSize, fn);
+			wait(handle);
+		}
+	};
+}
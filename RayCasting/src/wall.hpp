@@ -3,6 +3,8 @@
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 
+#include <cstdint>
+
 #include "line.hpp"
 
 
@@ -18,8 +20,11 @@ namespace wall
 
 		ds::ColorRGB color;
 
-		Wall(glm::vec2 start, glm::vec2 end, float height, ds::ColorRGB color) :
-			line{ start, end }, height{ height }, color{ color }
+		// Texture of the wall, an index into the texture manifest
+		uint32_t material;
+
+		Wall(glm::vec2 start, glm::vec2 end, float height, ds::ColorRGB color, uint32_t material = 0) :
+			line{ start, end }, height{ height }, color{ color }, material{ material }
 		{
 		}
 	};